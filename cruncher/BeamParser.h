@@ -0,0 +1,291 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Parse a data block into LZ symbols using a beam search.
+
+This is a faster alternative to the local optimal parse of LZParser. It
+uses the same cost model and considers the same matches, but instead of
+keeping the best parse for every previous reference offset, it keeps only
+the beam_width best parses (by total size) at each position. Likewise, at
+most beam_width edges are kept for each target position.
+
+The edge sets are kept in a ring indexed by target position, which only
+needs to span the longest match seen so far. It grows when a longer match
+turns up. When the reference edge limit is reached, new edges are
+discarded, so the limit bounds the memory used by the parse as well.
+
+With a small beam width, the parser runs in time roughly proportional to
+the data size, at the cost of a slightly worse compression ratio.
+
+*/
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+using std::max;
+using std::min;
+using std::vector;
+
+#include "LZParser.h"
+#include "Counters.h"
+
+class BeamParser {
+	const unsigned char *data;
+	int data_length;
+	int zero_padding;
+	MatchFinder& finder;
+	int length_margin;
+	int skip_length;
+	int beam_width;
+	const LZEncoder* encoderp;
+	RefEdgeFactory* edge_factory;
+
+	vector<long long> literal_size;
+
+	// beam_width slots for each target position in the ring, followed by
+	// the current beam. The ring size is a power of two.
+	int ring_size;
+	int beam;
+	vector<RefEdge*> slots;
+	vector<int> slot_count;
+
+	int setFor(int pos) {
+		return pos & (ring_size - 1);
+	}
+
+	RefEdge** slotsFor(int set) {
+		return &slots[(size_t) set * beam_width];
+	}
+
+	void allocateRing(int size) {
+		ring_size = size;
+		beam = size;
+		slots.assign((size_t) (size + 1) * beam_width, NULL);
+		slot_count.assign(size + 1, 0);
+	}
+
+	void copySet(RefEdge **edges, int count, int set) {
+		RefEdge **s = slotsFor(set);
+		for (int i = 0 ; i < count ; i++) {
+			s[i] = edges[i];
+		}
+		slot_count[set] = count;
+	}
+
+	// Grow the ring to hold targets up to the given distance ahead of pos
+	void growRing(int pos, int distance) {
+		int old_size = ring_size;
+		vector<RefEdge*> old_slots;
+		vector<int> old_count;
+		old_slots.swap(slots);
+		old_count.swap(slot_count);
+		int size = old_size;
+		while (size <= distance) size *= 2;
+		allocateRing(size);
+		for (int target = pos ; target < pos + old_size ; target++) {
+			int from = target & (old_size - 1);
+			copySet(&old_slots[(size_t) from * beam_width], old_count[from], setFor(target));
+		}
+		copySet(&old_slots[(size_t) old_size * beam_width], old_count[old_size], beam);
+	}
+
+	void releaseEdge(RefEdge *edge) {
+		int chain = 0;
+		while (edge != NULL) {
+			RefEdge *source = edge->source;
+			if (--edge->refcount == 0) {
+				edge_factory->destroy(edge, false);
+				chain++;
+			} else {
+				break;
+			}
+			edge = source;
+		}
+		Counters::add(COUNTER_EDGE_RELEASES);
+		Counters::add(COUNTER_RELEASE_CHAIN_TOTAL, chain);
+		Counters::maximum(COUNTER_RELEASE_CHAIN_MAX, chain);
+	}
+
+	// Replace edge held by a reference, keeping the new edge alive
+	void hold(RefEdge*& holder, RefEdge *edge) {
+		edge->refcount++;
+		releaseEdge(holder);
+		holder = edge;
+	}
+
+	void releaseAll(int set) {
+		RefEdge **s = slotsFor(set);
+		for (int i = 0 ; i < slot_count[set] ; i++) {
+			releaseEdge(s[i]);
+		}
+		slot_count[set] = 0;
+	}
+
+	// Find edge with the given offset in a set
+	RefEdge* findOffset(int set, int offset) {
+		RefEdge **s = slotsFor(set);
+		for (int i = 0 ; i < slot_count[set] ; i++) {
+			if (s[i]->offset == offset) return s[i];
+		}
+		return NULL;
+	}
+
+	// Insert edge into a set, keeping only the best edge for each offset
+	// and only the beam_width best edges overall.
+	void put(int set, RefEdge *edge) {
+		RefEdge **s = slotsFor(set);
+		int& count = slot_count[set];
+		int worst = -1;
+		for (int i = 0 ; i < count ; i++) {
+			if (s[i]->offset == edge->offset) {
+				if (edge->total_size < s[i]->total_size) {
+					Counters::add(COUNTER_EDGES_REPLACED);
+					releaseEdge(s[i]);
+					s[i] = edge;
+				} else {
+					Counters::add(COUNTER_EDGES_REJECTED);
+					releaseEdge(edge);
+				}
+				return;
+			}
+			if (worst == -1 || s[i]->total_size > s[worst]->total_size) {
+				worst = i;
+			}
+		}
+		if (count < beam_width) {
+			s[count++] = edge;
+		} else if (edge->total_size < s[worst]->total_size) {
+			Counters::add(COUNTER_EDGES_REPLACED);
+			releaseEdge(s[worst]);
+			s[worst] = edge;
+		} else {
+			Counters::add(COUNTER_EDGES_REJECTED);
+			releaseEdge(edge);
+		}
+	}
+
+	void newEdge(RefEdge *source, int pos, int offset, int length) {
+		if (offset == source->offset && pos == source->target()) return;
+		if (edge_factory->full()) {
+			Counters::add(COUNTER_EDGES_CLEANED);
+			edge_factory->discard();
+			return;
+		}
+		int prev_target = source->target();
+		int new_target = pos + length;
+		LZState state_before;
+		LZState state_after;
+		encoderp->constructState(&state_before, pos, pos == prev_target, source->offset);
+		long long size_before = source->total_size - (literal_size[data_length] - literal_size[pos]);
+		int edge_size = encoderp->encodeReference(offset, length, &state_before, &state_after);
+		long long size_after = literal_size[data_length] - literal_size[new_target];
+		if (length >= ring_size) {
+			growRing(pos, length);
+		}
+		RefEdge *new_edge = edge_factory->create(pos, offset, length, size_before + edge_size + size_after, source);
+		Counters::add(COUNTER_EDGES_CREATED);
+		put(setFor(new_target), new_edge);
+	}
+
+public:
+	BeamParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder, int length_margin, int skip_length, int beam_width, RefEdgeFactory* edge_factory)
+		: data(data), data_length(data_length), zero_padding(zero_padding), finder(finder), length_margin(length_margin), skip_length(skip_length), beam_width(beam_width), edge_factory(edge_factory)
+	{
+		int size = 1;
+		while (size < min(data_length + 1, 1024)) size *= 2;
+		allocateRing(size);
+	}
+
+	LZParseResult parse(const LZEncoder& encoder, LZProgress *progress) {
+		progress->begin(data_length);
+		encoderp = &encoder;
+		edge_factory->reset();
+
+		// Accumulate literal sizes
+		literal_size.resize(data_length + 1, 0);
+		long long size = 0;
+		LZState literal_state;
+		encoder.setInitialState(&literal_state);
+		for (int i = 0 ; i < data_length ; i++) {
+			literal_size[i] = size;
+			size += encoder.encodeLiteral(data[i], &literal_state, &literal_state);
+		}
+		literal_size[data_length] = size;
+
+		// Parse
+		RefEdge* initial_best = edge_factory->create(0, 0, 0, literal_size[data_length], NULL);
+		RefEdge* best = NULL;
+		hold(best, initial_best);
+		for (int pos = 1 ; pos <= data_length ; pos++) {
+			// Assimilate edges ending here into the beam
+			int arriving_set = setFor(pos);
+			RefEdge **arriving = slotsFor(arriving_set);
+			for (int i = 0 ; i < slot_count[arriving_set] ; i++) {
+				put(beam, arriving[i]);
+			}
+			slot_count[arriving_set] = 0;
+			RefEdge **current = slotsFor(beam);
+			for (int i = 0 ; i < slot_count[beam] ; i++) {
+				if (current[i]->total_size < best->total_size) {
+					hold(best, current[i]);
+				}
+			}
+
+			// Add new edges according to matches
+			finder.beginMatching(pos);
+			int match_pos;
+			int match_length;
+			int max_match_length = 0;
+			while (finder.nextMatch(&match_pos, &match_length)) {
+				int offset = pos - match_pos;
+				if (match_length > data_length - pos) {
+					match_length = data_length - pos;
+				}
+				int min_length = match_length - length_margin;
+				if (min_length < 2) min_length = 2;
+				RefEdge *same_offset = best->offset != offset ? findOffset(beam, offset) : NULL;
+				for (int length = min_length ; length <= match_length ; length++) {
+					newEdge(best, pos, offset, length);
+					if (same_offset) {
+						newEdge(same_offset, pos, offset, length);
+					}
+				}
+				max_match_length = max(max_match_length, match_length);
+			}
+
+			// If we have a very long match, skip ahead
+			if (max_match_length >= skip_length && max_match_length < ring_size && slot_count[setFor(pos + max_match_length)] > 0) {
+				releaseAll(beam);
+				int target_pos = pos + max_match_length;
+				while (pos < target_pos - 1) {
+					releaseAll(setFor(++pos));
+				}
+				hold(best, initial_best);
+			}
+
+			progress->update(pos);
+		}
+
+		// Keep only the best path
+		releaseAll(beam);
+
+		LZParseResult result;
+		result.data = data;
+		result.data_length = data_length;
+		result.zero_padding = zero_padding;
+		RefEdge *edge = best;
+		while (edge->length > 0) {
+			result.edges.push_back(LZResultEdge(edge));
+			edge = edge->source;
+		}
+		releaseEdge(edge);
+		releaseEdge(best);
+
+		progress->end();
+
+		return result;
+	}
+};
@@ -0,0 +1,244 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Sidecar index of checkpoints into a single compressed data stream.
+
+A checkpoint holds the complete decoder state at a symbol boundary, so
+decoding can start there rather than at the beginning. Every byte of the
+data is ultimately copied from some literal. Each checkpoint records the
+lowest position of such a literal among the bytes decoded before the next
+checkpoint. To decode a range, decoding starts at the latest checkpoint
+at or before the lowest literal the range derives from. Data referenced
+from before that checkpoint is not available and decodes as zeros, but
+none of it ends up in the range.
+
+The compressed data itself is not affected by the index. The index
+records a hash of the compressed data, so it is not used with other data.
+
+File format, in big-endian longwords:
+  "ShCk" <version> <flags> <compressed size> <hash high> <hash low>
+  <uncompressed size> <number of contexts> <number of checkpoints>
+  For each checkpoint:
+    <position> <lowest literal position, or -1 for none>
+    <byte position> <value bits> <window high> <window low>
+    <interval size> <offset> <flags>
+    <context probabilities, as words padded to a whole longword>
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <vector>
+
+using std::vector;
+
+#include "AmigaWords.h"
+#include "Decompressor.h"
+
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_FLAG_PARITY (1 << 0)
+#define CHECKPOINT_FLAG_REF (1 << 0)
+#define CHECKPOINT_FLAG_PREV_WAS_REF (1 << 1)
+
+class CheckpointIndex {
+	struct Entry {
+		DecompressorCheckpoint state;
+		int min_origin;
+	};
+
+	vector<Entry> entries;
+	int compressed_size;
+	unsigned long long data_hash;
+	int uncompressed_size;
+	bool parity_context;
+	int n_contexts;
+
+	static void put(vector<Longword>& out, unsigned value) {
+		out.push_back(value);
+	}
+
+	static bool get(FILE *file, unsigned *value) {
+		Longword lw;
+		if (fread(&lw, sizeof(Longword), 1, file) != 1) return false;
+		*value = lw;
+		return true;
+	}
+
+	// 64-bit FNV-1a hash of the compressed data
+	static unsigned long long hash(const unsigned char *packed, int packed_size) {
+		unsigned long long h = 0xCBF29CE484222325ULL;
+		for (int i = 0 ; i < packed_size ; i++) {
+			h = (h ^ packed[i]) * 0x100000001B3ULL;
+		}
+		return h;
+	}
+
+public:
+	CheckpointIndex() : compressed_size(0), data_hash(0), uncompressed_size(0), parity_context(true), n_contexts(0) {}
+
+	// Decode compressed data, taking a checkpoint every interval bytes.
+	// Returns false if the data is corrupt.
+	bool build(const unsigned char *packed, int packed_size, bool parity_context, int n_contexts, int interval) {
+		this->compressed_size = packed_size;
+		this->data_hash = hash(packed, packed_size);
+		this->parity_context = parity_context;
+		this->n_contexts = n_contexts;
+		entries.clear();
+
+		Decompressor decompressor(packed, packed_size, n_contexts);
+		vector<unsigned char> out;
+		vector<int> origins;
+		decompressor.track_origins(&origins);
+		while (true) {
+			Entry entry;
+			decompressor.save(entry.state);
+			long long stop_pos = (long long) decompressor.position() + interval;
+			int result = decompressor.decode(out, 0, parity_context, INT_MAX, (int) min(stop_pos, (long long) INT_MAX));
+			if (result == Decompressor::DECODE_ERROR) return false;
+			entry.min_origin = decompressor.take_min_origin();
+			entries.push_back(entry);
+			if (result == Decompressor::DECODE_END) break;
+		}
+		uncompressed_size = out.size();
+		return true;
+	}
+
+	int size() {
+		return entries.size();
+	}
+
+	// Does the index belong to this compressed data and format?
+	bool matches(const unsigned char *packed, int packed_size, bool parity_context, int n_contexts) {
+		return packed_size == compressed_size && parity_context == this->parity_context &&
+		       n_contexts == this->n_contexts && hash(packed, packed_size) == data_hash;
+	}
+
+	int total_size() {
+		return uncompressed_size;
+	}
+
+	bool save(const char *filename) {
+		vector<Longword> out;
+		out.push_back(0);
+		memcpy(&out[0], "ShCk", 4);
+		put(out, CHECKPOINT_VERSION);
+		put(out, parity_context ? CHECKPOINT_FLAG_PARITY : 0);
+		put(out, compressed_size);
+		put(out, data_hash >> 32);
+		put(out, data_hash & 0xffffffff);
+		put(out, uncompressed_size);
+		put(out, n_contexts);
+		put(out, entries.size());
+		for (int i = 0 ; i < entries.size() ; i++) {
+			const Entry& e = entries[i];
+			const DecompressorCheckpoint& s = e.state;
+			put(out, s.pos);
+			put(out, e.min_origin == INT_MAX ? -1 : e.min_origin);
+			put(out, s.byte_pos);
+			put(out, s.value_bits);
+			put(out, s.window >> 32);
+			put(out, s.window & 0xffffffff);
+			put(out, s.intervalsize);
+			put(out, s.offset);
+			put(out, (s.ref ? CHECKPOINT_FLAG_REF : 0) | (s.prev_was_ref ? CHECKPOINT_FLAG_PREV_WAS_REF : 0));
+			for (int c = 0 ; c < n_contexts ; c += 2) {
+				put(out, (s.contexts[c] << 16) | (c + 1 < n_contexts ? s.contexts[c + 1] : 0));
+			}
+		}
+
+		FILE *file;
+		if ((file = fopen(filename, "wb"))) {
+			bool ok = fwrite(&out[0], sizeof(Longword), out.size(), file) == out.size();
+			if (fclose(file) == 0 && ok) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Returns false if the file could not be read or is not a valid index
+	bool load(const char *filename) {
+		FILE *file = fopen(filename, "rb");
+		if (!file) return false;
+		entries.clear();
+		char magic[4];
+		unsigned version, flags, csize, hash_hi, hash_lo, usize, ncontexts, count;
+		bool ok = fread(magic, 1, 4, file) == 4 && memcmp(magic, "ShCk", 4) == 0 &&
+		          get(file, &version) && version == CHECKPOINT_VERSION &&
+		          get(file, &flags) && get(file, &csize) && get(file, &hash_hi) && get(file, &hash_lo) && get(file, &usize) &&
+		          get(file, &ncontexts) && get(file, &count) &&
+		          csize <= INT_MAX && usize <= INT_MAX && ncontexts > 0 && ncontexts <= 65536;
+		for (unsigned i = 0 ; ok && i < count ; i++) {
+			Entry e;
+			DecompressorCheckpoint& s = e.state;
+			unsigned pos, min_origin, byte_pos, value_bits, window_hi, window_lo, intervalsize, offset, state_flags;
+			ok = get(file, &pos) && get(file, &min_origin) && get(file, &byte_pos) && get(file, &value_bits) &&
+			     get(file, &window_hi) && get(file, &window_lo) && get(file, &intervalsize) &&
+			     get(file, &offset) && get(file, &state_flags) &&
+			     pos <= usize && byte_pos <= csize + 8 && value_bits <= 56 && offset <= usize &&
+			     intervalsize >= 1 && intervalsize <= 0x10000 &&
+			     (entries.empty() ? pos == 0 : pos > entries.back().state.pos);
+			if (!ok) break;
+			vector<Word> contexts((ncontexts + 1) & -2);
+			ok = fread(&contexts[0], sizeof(Word), contexts.size(), file) == contexts.size();
+			s.pos = pos;
+			e.min_origin = min_origin == (unsigned) -1 ? INT_MAX : (int) min_origin;
+			s.byte_pos = byte_pos;
+			s.value_bits = value_bits;
+			s.window = ((unsigned long long) window_hi << 32) | window_lo;
+			s.intervalsize = intervalsize;
+			s.offset = offset;
+			s.ref = (state_flags & CHECKPOINT_FLAG_REF) != 0;
+			s.prev_was_ref = (state_flags & CHECKPOINT_FLAG_PREV_WAS_REF) != 0;
+			s.contexts.assign(contexts.begin(), contexts.begin() + ncontexts);
+			entries.push_back(e);
+		}
+		fclose(file);
+		if (!ok || entries.empty()) return false;
+		compressed_size = csize;
+		data_hash = ((unsigned long long) hash_hi << 32) | hash_lo;
+		uncompressed_size = usize;
+		parity_context = (flags & CHECKPOINT_FLAG_PARITY) != 0;
+		n_contexts = ncontexts;
+		return true;
+	}
+
+	// Decode length bytes from position start into out. The position of
+	// the checkpoint decoding started from is stored in from_pos.
+	// Returns false if the data is corrupt.
+	bool decode_range(const unsigned char *packed, int start, int length, vector<unsigned char>& out, int *from_pos) {
+		int end = start + min(length, uncompressed_size - start);
+
+		// Checkpoints covering the range
+		int first = 0;
+		int last = 0;
+		for (int i = 0 ; i < entries.size() ; i++) {
+			if (entries[i].state.pos <= start) first = i;
+			if (entries[i].state.pos < end) last = i;
+		}
+
+		// Go back to the lowest literal the range derives from
+		int min_origin = INT_MAX;
+		for (int i = first ; i <= last ; i++) {
+			min_origin = min(min_origin, entries[i].min_origin);
+		}
+		while (first > 0 && min_origin < entries[first].state.pos) {
+			first--;
+		}
+
+		Decompressor decompressor(packed, compressed_size, n_contexts);
+		decompressor.restore(entries[first].state);
+		decompressor.allow_missing(true);
+		int base = entries[first].state.pos;
+		*from_pos = base;
+		vector<unsigned char> decoded;
+		int result = decompressor.decode(decoded, base, parity_context, uncompressed_size, end);
+		if (result == Decompressor::DECODE_ERROR || decompressor.position() < end) return false;
+		out.assign(decoded.begin() + (start - base), decoded.begin() + (end - base));
+		return true;
+	}
+};
@@ -14,12 +14,16 @@ Abstract interface for entropy coding.
 
 using std::vector;
 
+#include "MemoryTracker.h"
+
 class Coder {
 	bool cacheable;
 	bool has_cache;
 	int number_context_offset;
 	int n_number_contexts;
-	vector<vector<unsigned short> > cache;
+	typedef vector<unsigned short, TrackedAllocator<unsigned short, MEMORY_CODER_CACHES> > SizeCache;
+
+	vector<SizeCache> cache;
 
 protected:
 	Coder() : cacheable(false), has_cache(false)
@@ -40,8 +44,8 @@ public:
 		cache.clear();
 		for (int context_index = 0 ; context_index < n_number_contexts ; context_index++) {
 			int base_context = number_context_offset + (context_index << 8);
-			cache.push_back(vector<unsigned short>());
-			vector<unsigned short>& c = cache.back();
+			cache.push_back(SizeCache());
+			SizeCache& c = cache.back();
 			c.resize(4);
 			c[2] = code(base_context + 2, 0) + code(base_context + 1, 0);
 			c[3] = code(base_context + 2, 0) + code(base_context + 1, 1);
@@ -86,7 +90,7 @@ public:
 
 		if (has_cache) {
 			int context_index = (base_context - number_context_offset) >> 8;
-			vector<unsigned short>& cache_for_context = cache[context_index];
+			SizeCache& cache_for_context = cache[context_index];
 			if (number < cache_for_context.size()) {
 				return cache_for_context[number];
 			}
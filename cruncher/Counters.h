@@ -0,0 +1,132 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Event counters for the inner loops of the cruncher.
+
+The counting policy is chosen at compile time. Build with COUNTERS=1 (which
+defines SHRINKLER_COUNTERS) to count how often the match finder runs out
+of patience, how reference edges are created, rejected and released, how
+much work the cuckoo hash maps, the edge heap and the range coder do.
+Otherwise, all counting compiles to nothing.
+
+Counts are kept per thread, and are taken and printed for each hunk or
+block after crunching.
+
+*/
+
+#pragma once
+
+#include <cstring>
+#include <algorithm>
+
+#include "Status.h"
+
+enum Counter {
+	COUNTER_LEFT_PATIENCE_EXHAUSTED,
+	COUNTER_RIGHT_PATIENCE_EXHAUSTED,
+	COUNTER_EDGES_CREATED,
+	COUNTER_EDGES_REJECTED,
+	COUNTER_EDGES_REPLACED,
+	COUNTER_EDGES_CLEANED,
+	COUNTER_EDGE_RELEASES,
+	COUNTER_RELEASE_CHAIN_TOTAL,
+	COUNTER_RELEASE_CHAIN_MAX,
+	COUNTER_CUCKOO_INSERTS,
+	COUNTER_CUCKOO_KICKS,
+	COUNTER_CUCKOO_REHASHES,
+	COUNTER_HEAP_INSERTS,
+	COUNTER_HEAP_REMOVALS,
+	COUNTER_HEAP_SWAPS,
+	COUNTER_RANGE_CODED_BITS,
+	COUNTER_RANGE_CARRIES,
+	COUNTER_RANGE_CARRY_STEPS,
+	NUM_COUNTERS
+};
+
+struct CounterSet {
+	long long values[NUM_COUNTERS];
+
+	CounterSet() {
+		clear();
+	}
+
+	void clear() {
+		memset(values, 0, sizeof(values));
+	}
+
+	void print(const char *kind, int index) const {
+		static const char *names[NUM_COUNTERS] = {
+			"Left match patience exhausted",
+			"Right match patience exhausted",
+			"Reference edges created",
+			"Reference edges rejected",
+			"Reference edges replaced",
+			"Reference edges cleaned",
+			"Reference edge releases",
+			"Release chain length total",
+			"Release chain length max",
+			"Cuckoo hash inserts",
+			"Cuckoo hash kicks",
+			"Cuckoo hash rehashes",
+			"Edge heap inserts",
+			"Edge heap removals",
+			"Edge heap swaps",
+			"Range coded bits",
+			"Range coder carries",
+			"Range coder carry steps",
+		};
+		status("Counters for %s %d:\n", kind, index);
+		for (int c = 0 ; c < NUM_COUNTERS ; c++) {
+			status("  %-32s%16lld\n", names[c], values[c]);
+		}
+		status("\n");
+	}
+};
+
+// Counting policy which counts into the counters of the current thread
+class ThreadCounters {
+public:
+	static const bool enabled = true;
+
+	static CounterSet& current() {
+		thread_local CounterSet counters;
+		return counters;
+	}
+
+	static void add(Counter counter, long long n = 1) {
+		current().values[counter] += n;
+	}
+
+	static void maximum(Counter counter, long long n) {
+		long long& value = current().values[counter];
+		value = std::max(value, n);
+	}
+
+	// Take the counts of the current thread, clearing them
+	static CounterSet take() {
+		CounterSet counters = current();
+		current().clear();
+		return counters;
+	}
+};
+
+// Counting policy which does nothing
+class NoCounters {
+public:
+	static const bool enabled = false;
+
+	static void add(Counter counter, long long n = 1) {}
+
+	static void maximum(Counter counter, long long n) {}
+
+	static CounterSet take() {
+		return CounterSet();
+	}
+};
+
+#ifdef SHRINKLER_COUNTERS
+typedef ThreadCounters Counters;
+#else
+typedef NoCounters Counters;
+#endif
@@ -23,6 +23,9 @@ class CountingCoder : public Coder {
 	vector<ContextCounts> context_counts;
 
 	friend class SizeMeasuringCoder;
+	friend class ModelStatistics;
+	friend class ResultCacheKey;
+	friend class ResultCache;
 public:
 	CountingCoder(int n_contexts) {
 		struct ContextCounts init_counts = { { 0, 0 } };
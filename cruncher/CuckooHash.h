@@ -12,6 +12,9 @@ Cuckoo hash map. Used for mapping offsets to edges in the LZ parser.
 #include <algorithm>
 #include <new>
 
+#include "Counters.h"
+#include "MemoryTracker.h"
+
 using std::pair;
 
 template <typename V> class CuckooHash;
@@ -77,12 +80,20 @@ private:
 	void init_array() {
 		int size = array_size();
 		element_array = new value_type[size];
+		MemoryTracker::allocated(MEMORY_CUCKOO_HASH, size * sizeof(value_type));
 		for (int i = 0 ; i < size ; i++) {
 			element_array[i].first = UNUSED;
 			element_array[i].second = V();
 		}
 	}
 
+	void free_array() {
+		if (element_array != NULL) {
+			MemoryTracker::freed(MEMORY_CUCKOO_HASH, array_size() * sizeof(value_type));
+			delete[] element_array;
+		}
+	}
+
 	value_type* get_array() {
 		if (element_array == NULL) {
 			init_array();
@@ -103,6 +114,7 @@ private:
 	}
 
 	void rehash() {
+		Counters::add(COUNTER_CUCKOO_REHASHES);
 		int old_size = array_size();
 		value_type* old_array = get_array();
 		n_elements = 0;
@@ -114,16 +126,19 @@ private:
 			}
 		}
 		delete[] old_array;
+		MemoryTracker::freed(MEMORY_CUCKOO_HASH, old_size * sizeof(value_type));
 	}
 
 	void insert(hash_type hash, int key, V value, int n) {
 		value_type* array = get_array();
+		Counters::add(COUNTER_CUCKOO_INSERTS);
 		while (array[hash].first != UNUSED) {
 			if (--n < 0) {
 				rehash();
 				(*this)[key] = value;
 				return;
 			}
+			Counters::add(COUNTER_CUCKOO_KICKS);
 			std::swap(key, array[hash].first);
 			std::swap(value, array[hash].second);
 			hash_type hash1;
@@ -147,11 +162,11 @@ public:
 	}
 
 	~CuckooHash() {
-		delete[] element_array;
+		free_array();
 	}
 
 	void clear() {
-		delete[] element_array;
+		free_array();
 		init();
 	}
 
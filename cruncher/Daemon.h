@@ -0,0 +1,311 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Client and server for running Shrinkler commands in a persistent process.
+
+The server listens on a Unix domain socket. A client sends its command
+line and working directory, along with its standard output and error file
+descriptors. The server runs the command in the working directory of the
+client, with status output going directly to the client's output, and
+finally replies with the exit code. Commands are run one at a time, so
+that state kept by the server between commands is never shared. Since
+commands change the working directory of the whole process, they cannot
+run concurrently in one server. Reference buffers are kept between
+commands, but the threads of a command are started anew for each command.
+
+When the server picks up a connection, it first tells the client that it
+is ready. A client which does not hear from the server in time, because
+the server is busy with another command, gives up and runs the command
+itself. Thus parallel builds are not serialized by the server.
+
+The socket is only accessible to the user running the server, and
+connections from other users are refused. A client which does not send
+its request in time is dropped, so it cannot hold up other clients.
+A server does not take over the socket of another server which is still
+running.
+
+Server greeting:
+  <ready: int>
+Request format:
+  <payload length: int>, sent along with the two file descriptors
+  <working directory>\0<argv[0]>\0<argv[1]>\0...
+Reply:
+  <exit code: int>
+
+*/
+
+#pragma once
+
+#if !defined(_WIN32) && !defined(AMIGA)
+#define DAEMON_SUPPORTED
+
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+
+using std::string;
+using std::vector;
+
+// Runs a command with the given output streams and returns its exit code
+class CommandRunner {
+public:
+	virtual int run(int argc, const char *argv[], FILE *out, FILE *err) = 0;
+
+	virtual ~CommandRunner() {}
+};
+
+class Daemon {
+	// Seconds a client may take to send its request
+	static const int REQUEST_TIMEOUT = 10;
+	// Milliseconds a client waits for the server to pick up its connection
+	static const int READY_TIMEOUT = 1000;
+	static const int READY = 0x52454459; // "REDY"
+
+	static void set_timeout(int fd, int option, int milliseconds) {
+		timeval timeout;
+		timeout.tv_sec = milliseconds / 1000;
+		timeout.tv_usec = milliseconds % 1000 * 1000;
+		setsockopt(fd, SOL_SOCKET, option, &timeout, sizeof(timeout));
+	}
+
+	static bool make_address(const char *path, sockaddr_un *address) {
+		if (strlen(path) >= sizeof(address->sun_path)) return false;
+		memset(address, 0, sizeof(sockaddr_un));
+		address->sun_family = AF_UNIX;
+		strcpy(address->sun_path, path);
+		return true;
+	}
+
+	static bool send_all(int fd, const void *buffer, int size) {
+		const char *p = (const char *) buffer;
+		while (size > 0) {
+			int n = write(fd, p, size);
+			if (n <= 0) return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	static bool receive_all(int fd, void *buffer, int size) {
+		char *p = (char *) buffer;
+		while (size > 0) {
+			int n = read(fd, p, size);
+			if (n <= 0) return false;
+			p += n;
+			size -= n;
+		}
+		return true;
+	}
+
+	// Send an int along with file descriptors
+	static bool send_with_fds(int fd, int value, const int *fds, int n_fds) {
+		iovec iov;
+		iov.iov_base = &value;
+		iov.iov_len = sizeof(int);
+		vector<char> control(CMSG_SPACE(n_fds * sizeof(int)));
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = &control[0];
+		message.msg_controllen = control.size();
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+		return sendmsg(fd, &message, 0) == sizeof(int);
+	}
+
+	// Receive an int along with exactly n_fds file descriptors
+	static bool receive_with_fds(int fd, int *value, int *fds, int n_fds) {
+		iovec iov;
+		iov.iov_base = value;
+		iov.iov_len = sizeof(int);
+		vector<char> control(CMSG_SPACE(n_fds * sizeof(int)));
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = &control[0];
+		message.msg_controllen = control.size();
+		if (recvmsg(fd, &message, 0) != sizeof(int)) return false;
+		cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+		if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len != CMSG_LEN(n_fds * sizeof(int))) {
+			return false;
+		}
+		memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+		return true;
+	}
+
+	// Whether the peer of a connection is the user running the server
+	static bool same_user(int connection) {
+#ifdef SO_PEERCRED
+		ucred credentials;
+		socklen_t size = sizeof(credentials);
+		if (getsockopt(connection, SOL_SOCKET, SO_PEERCRED, &credentials, &size) != 0) return false;
+		return credentials.uid == getuid();
+#else
+		uid_t uid;
+		gid_t gid;
+		if (getpeereid(connection, &uid, &gid) != 0) return false;
+		return uid == getuid();
+#endif
+	}
+
+	static void serve(int connection, CommandRunner *runner, int home_dir) {
+		if (!same_user(connection)) return;
+		int ready = READY;
+		if (!send_all(connection, &ready, sizeof(int))) return;
+
+		// Only the request is subject to the timeout, not the command
+		set_timeout(connection, SO_RCVTIMEO, REQUEST_TIMEOUT * 1000);
+
+		int length;
+		int fds[2];
+		if (!receive_with_fds(connection, &length, fds, 2)) return;
+		vector<char> payload(length > 0 && length < (1 << 24) ? length : 0);
+		if (payload.empty() || !receive_all(connection, &payload[0], length) || payload.back() != 0) {
+			close(fds[0]);
+			close(fds[1]);
+			return;
+		}
+
+		// Split payload into working directory and arguments
+		vector<const char*> strings;
+		for (int i = 0 ; i < length ; i += strlen(&payload[i]) + 1) {
+			strings.push_back(&payload[i]);
+		}
+
+		FILE *out = fdopen(fds[0], "w");
+		FILE *err = fdopen(fds[1], "w");
+		int code = 1;
+		if (strings.size() < 2) {
+			fprintf(err, "Error: Malformed daemon request.\n\n");
+		} else if (chdir(strings[0]) != 0) {
+			fprintf(err, "Error: Daemon could not enter directory %s\n\n", strings[0]);
+		} else {
+			code = runner->run(strings.size() - 1, &strings[1], out, err);
+			if (fchdir(home_dir) != 0) {
+				fprintf(stderr, "Warning: Daemon could not return to its own directory.\n");
+			}
+		}
+		fclose(out);
+		fclose(err);
+		send_all(connection, &code, sizeof(int));
+	}
+
+	// Connect to the socket, giving up if the connection is not accepted in time
+	static int connect_to(const char *path) {
+		sockaddr_un address;
+		if (!make_address(path, &address)) return -1;
+		int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (connection < 0) return -1;
+		set_timeout(connection, SO_SNDTIMEO, READY_TIMEOUT);
+		if (connect(connection, (sockaddr *) &address, sizeof(address)) != 0) {
+			int error = errno;
+			close(connection);
+			errno = error;
+			return -1;
+		}
+		return connection;
+	}
+
+public:
+	// Whether a server is listening on the given socket
+	static bool running(const char *path) {
+		int connection = connect_to(path);
+		if (connection >= 0) {
+			close(connection);
+			return true;
+		}
+		// A server with a full backlog does not accept connections in time
+		return errno == EAGAIN || errno == EWOULDBLOCK;
+	}
+
+	// Serve commands until killed. Returns only if the socket could not be set up.
+	static bool run_server(const char *path, CommandRunner *runner) {
+		sockaddr_un address;
+		if (!make_address(path, &address)) return false;
+		if (running(path)) return false;
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (listener < 0) return false;
+
+		// Remove socket left by a previous daemon
+		struct stat info;
+		if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+			unlink(path);
+		}
+		// Create the socket accessible only to the current user
+		mode_t old_mask = umask(0077);
+		bool bound = bind(listener, (sockaddr *) &address, sizeof(address)) == 0;
+		umask(old_mask);
+		if (!bound || chmod(path, 0600) != 0 || listen(listener, 16) != 0) {
+			close(listener);
+			return false;
+		}
+
+		// Clients disappearing must not kill the daemon
+		signal(SIGPIPE, SIG_IGN);
+
+		int home_dir = open(".", O_RDONLY);
+		while (true) {
+			int connection = accept(listener, NULL, NULL);
+			if (connection < 0) continue;
+			serve(connection, runner, home_dir);
+			close(connection);
+		}
+	}
+
+	// Run a command in the daemon listening on the given socket.
+	// Returns false if no daemon could be reached, or if it is busy.
+	static bool run_client(const char *path, int argc, const char *argv[], int *exit_code) {
+		int connection = connect_to(path);
+		if (connection < 0) return false;
+		set_timeout(connection, SO_RCVTIMEO, READY_TIMEOUT);
+		int ready;
+		if (!receive_all(connection, &ready, sizeof(int)) || ready != READY) {
+			close(connection);
+			return false;
+		}
+		// The command itself may take any amount of time
+		set_timeout(connection, SO_RCVTIMEO, 0);
+
+		vector<char> cwd(4096);
+		while (!getcwd(&cwd[0], cwd.size())) {
+			cwd.resize(cwd.size() * 2);
+		}
+		string payload(&cwd[0], strlen(&cwd[0]) + 1);
+		for (int i = 0 ; i < argc ; i++) {
+			payload.append(argv[i], strlen(argv[i]) + 1);
+		}
+
+		fflush(stdout);
+		fflush(stderr);
+		int fds[2] = { STDOUT_FILENO, STDERR_FILENO };
+		bool ok = send_with_fds(connection, payload.size(), fds, 2) &&
+		          send_all(connection, payload.data(), payload.size()) &&
+		          receive_all(connection, exit_code, sizeof(int));
+		close(connection);
+		if (!ok) {
+			fprintf(stderr, "Error: Lost connection to Shrinkler daemon at %s\n\n", path);
+			*exit_code = 1;
+		}
+		return true;
+	}
+};
+
+#endif
@@ -4,15 +4,36 @@
 
 Operations on raw data files, including loading, crunching and saving.
 
+Data can be crunched as a single stream or as a sequence of independent
+blocks. Each block is crunched with fresh contexts, so blocks can be
+crunched and decrunched in parallel, and any block can be decrunched on
+its own. The compressed size of every block is listed in an index at the
+end of the data file header:
+
+  <block size: Longword> <number of blocks: Longword>
+  <compressed size of each block: Longword>...
+
+All blocks except the last have the given uncompressed size.
+
+Files with a block index or a window carry a higher minor version than
+plain files, so readers predating these extensions can tell them apart.
+
 */
 
 #pragma once
 
 #include <cstring>
+#include <ctime>
+#include <climits>
 #include <algorithm>
 #include <string>
 #include <utility>
 #include <algorithm>
+#include <new>
+
+#ifndef AMIGA
+#include <chrono>
+#endif
 
 using std::make_pair;
 using std::max;
@@ -20,14 +41,30 @@ using std::min;
 using std::pair;
 using std::string;
 
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
 #include "AmigaWords.h"
+#include "Decompressor.h"
+#include "Checkpoints.h"
+#include "MappedFile.h"
+#include "Status.h"
 #include "Pack.h"
+#include "Report.h"
+#include "Trace.h"
+#include "Counters.h"
 #include "RangeDecoder.h"
 #include "Verifier.h"
+#include "ThreadPool.h"
 
 #define SHRINKLER_MAJOR_VERSION 4
 #define SHRINKLER_MINOR_VERSION 7
+#define SHRINKLER_MINOR_VERSION_EXTENDED 8 // With a block index or window
 #define FLAG_PARITY_CONTEXT (1 << 0)
+#define FLAG_BLOCKS (1 << 1)
+#define FLAG_WINDOW (1 << 2)
 
 struct DataHeader {
 	char magic[4];
@@ -42,39 +79,79 @@ struct DataHeader {
 
 class DataFile {
 	DataHeader header;
-	vector<unsigned char> data;
+	vector<unsigned char> buffer; // Contents owned by the data file
+	MappedFile *mapping;          // Contents mapped from the loaded file
+	const unsigned char *data;    // The data itself, in one of the above or owned by the caller
+	int length;
+	int block_length;             // Uncompressed size of each block, 0 for a single stream
+	vector<int> block_sizes;      // Compressed size of each block
+	int window;                   // Maximum reference offset, 0 for unlimited
+
+	DataFile(const DataFile&);
+	DataFile& operator=(const DataFile&);
+
+	// Refer to the contents of the buffer
+	void use_buffer() {
+		data = buffer.empty() ? NULL : &buffer[0];
+		length = buffer.size();
+	}
+
+	// Wall-clock time in seconds, for measuring decrunching speed
+	static double now() {
+#ifndef AMIGA
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		return clock() / (double) CLOCKS_PER_SEC;
+#endif
+	}
+
+	static void report_too_large(const char *filename) {
+		status("Error: File %s is too large. At most %d bytes are supported.\n\n", filename, INT_MAX);
+		fatal_error();
+	}
 
-	vector<unsigned char> compress(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress) {
+	vector<unsigned char> compress(PackParams *params, ModelStatistics *stats, RefEdgeFactory *edge_factory, LZProgress *progress) {
 		vector<unsigned char> pack_buffer;
 		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 
 		// Print compression status header
 		const char *ordinals[] = { "st", "nd", "rd", "th" };
-		printf("Original");
+		status("Original");
 		for (int p = 1 ; p <= params->iterations ; p++) {
-			printf("  After %d%s pass", p, ordinals[min(p,4)-1]);
+			status("  After %d%s pass", p, ordinals[min(p,4)-1]);
 		}
-		printf("\n");
+		status("\n");
 
 		// Crunch the data
 		range_coder.reset();
-		packData(&data[0], data.size(), 0, params, &range_coder, edge_factory, show_progress);
+		CountingCoder initial_counts(LZEncoder::NUM_CONTEXTS);
+		CountingCoder final_counts(LZEncoder::NUM_CONTEXTS);
+		bool seeded = stats && stats->seed(0, 0, length, &initial_counts);
+		packData(data, length, 0, params, &range_coder, edge_factory, progress,
+		         seeded ? &initial_counts : NULL, &final_counts);
+		if (stats) {
+			stats->record(0, 0, length, &final_counts);
+		}
 		range_coder.finish();
-		printf("\n\n");
-		fflush(stdout);
+		status("\n\n");
+		status_flush();
 
 		return pack_buffer;		
 	}
 
-	int verify(PackParams *params, vector<unsigned char>& pack_buffer) {
-		printf("Verifying... ");
-		fflush(stdout);
+	// Returns the safety margin needed for overlapped decrunching of the block
+	static int verify(PackParams *params, const unsigned char *data, int length, vector<unsigned char>& pack_buffer) {
+		TraceSpan verify_span("verify");
+		status("Verifying... ");
+		status_flush();
+		Stopwatch stopwatch;
 		RangeDecoder decoder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 		LZDecoder lzd(&decoder, params->parity_context);
 
 		// Verify data
 		bool error = false;
-		LZVerifier verifier(0, &data[0], data.size(), data.size(), 1);
+		LZVerifier verifier(0, data, length, length, 1);
+		verifier.max_offset = params->max_offset;
 		decoder.reset();
 		decoder.setListener(&verifier);
 		if (!lzd.decode(verifier)) {
@@ -82,79 +159,577 @@ class DataFile {
 		}
 
 		// Check length
-		if (!error && verifier.size() != data.size()) {
-			printf("Verify error: data has incorrect length (%d, should have been %d)!\n", verifier.size(), (int) data.size());
+		if (!error && verifier.size() != length) {
+			status("Verify error: data has incorrect length (%d, should have been %d)!\n", verifier.size(), length);
 			error = true;
 		}
 
 		if (error) {
 			internal_error();
 		}
+		if (report_block()) {
+			report_block()->verify = stopwatch.elapsed();
+		}
+
+		status("OK\n\n");
+
+		return verifier.front_overlap_margin + pack_buffer.size() - length;
+	}
+
+	// Crunches the blocks of a data file into the block layout of another,
+	// each worker using its own reference buffer
+	class BlockCruncher : public JobRunner {
+		DataFile& file;
+		DataFile& layout;
+		PackParams *params;
+		vector<RefEdgeFactory*>& edge_factories;
+		RunReport *report;
+		Trace *trace;
+
+	public:
+		vector<vector<unsigned char> > packed;
+		vector<int> margins;
+		vector<int> errors;
+		vector<CounterSet> counters;
+
+		BlockCruncher(DataFile& file, DataFile& layout, PackParams *params, vector<RefEdgeFactory*>& edge_factories)
+			: file(file), layout(layout), params(params), edge_factories(edge_factories), report(report_current()), trace(trace_current()),
+			  packed(layout.block_count()), margins(layout.block_count()), errors(layout.block_count(), 0),
+			  counters(Counters::enabled ? layout.block_count() : 0) {}
+
+		virtual void run(int worker, int job) {
+			StatusRedirect quiet(NULL);
+			ReportScope report_scope(report);
+			TraceScope trace_scope(trace);
+			try {
+				const unsigned char *block = file.data + job * layout.block_length;
+				int block_length = layout.block_uncompressed_size(job);
+				ReportBlockScope report_block_scope("block", job, block_length);
+				TraceSpan block_span("block", "block", job);
+				Counters::take();
+				RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, packed[job]);
+				NoProgress no_progress;
+				range_coder.reset();
+				packData(block, block_length, 0, params, &range_coder, edge_factories[worker], &no_progress);
+				range_coder.finish();
+				if (Counters::enabled) {
+					counters[job] = Counters::take();
+				}
+				margins[job] = verify(params, block, block_length, packed[job]);
+			} catch (InternalError& e) {
+				errors[job] = 1;
+			} catch (std::bad_alloc& e) {
+				errors[job] = 2;
+			}
+		}
+	};
+
+	// Decrunches the blocks of a data file into the buffer of another
+	class BlockDecruncher : public JobRunner {
+		DataFile& file;
+		DataFile& target;
+		bool parity_context;
+
+	public:
+		vector<int> errors;
+
+		BlockDecruncher(DataFile& file, DataFile& target, bool parity_context)
+			: file(file), target(target), parity_context(parity_context), errors(file.block_count(), 0) {}
+
+		virtual void run(int worker, int job) {
+			try {
+				if (!file.decrunch_block(job, parity_context, &target.buffer[(size_t) job * file.block_length])) {
+					errors[job] = 1;
+				}
+			} catch (std::bad_alloc& e) {
+				errors[job] = 2;
+			}
+		}
+	};
+
+	// Size of the window and block index following the header
+	int header_extension_size() {
+		return (window ? sizeof(Longword) : 0) + (block_length ? (2 + block_sizes.size()) * sizeof(Longword) : 0);
+	}
+
+	// The data file header, including the window and block index if any
+	vector<unsigned char> header_bytes() {
+		vector<unsigned char> bytes((unsigned char *) &header, (unsigned char *) (&header + 1));
+		if (window) {
+			Longword window_size = window;
+			bytes.insert(bytes.end(), (unsigned char *) &window_size, (unsigned char *) (&window_size + 1));
+		}
+		if (block_length) {
+			vector<Longword> index;
+			index.push_back(block_length);
+			index.push_back(block_sizes.size());
+			index.insert(index.end(), block_sizes.begin(), block_sizes.end());
+			bytes.insert(bytes.end(), (unsigned char *) &index[0], (unsigned char *) (&index[0] + index.size()));
+		}
+		return bytes;
+	}
 
-		printf("OK\n\n");
+	// Read the block index following the header. Returns false if it is invalid.
+	bool read_block_index(const unsigned char *index_data, int index_size) {
+		if (index_size < 2 * sizeof(Longword)) return false;
+		const Longword *index = (const Longword *) index_data;
+		unsigned uncompressed_size = header.uncompressed_size;
+		unsigned count = index[1];
+		block_length = index[0];
+		if (block_length <= 0 || count > (index_size / sizeof(Longword)) - 2 ||
+		    count != (uncompressed_size + block_length - 1) / block_length) {
+			return false;
+		}
+		block_sizes.clear();
+		unsigned total = 0;
+		for (int b = 0 ; b < count ; b++) {
+			unsigned size = index[2 + b];
+			if (size > header.compressed_size - total) return false;
+			total += size;
+			block_sizes.push_back(size);
+		}
+		return total == header.compressed_size;
+	}
 
-		return verifier.front_overlap_margin + pack_buffer.size() - data.size();
+	void fill_header(PackParams *params, int uncompressed_size, int margin) {
+		header.magic[0] = 'S';
+		header.magic[1] = 'h';
+		header.magic[2] = 'r';
+		header.magic[3] = 'i';
+		header.major_version = SHRINKLER_MAJOR_VERSION;
+		header.minor_version = block_length || window ? SHRINKLER_MINOR_VERSION_EXTENDED : SHRINKLER_MINOR_VERSION;
+		header.header_size = sizeof(DataHeader) - 8 + header_extension_size();
+		header.compressed_size = length;
+		header.uncompressed_size = uncompressed_size;
+		header.safety_margin = margin;
+		header.flags = (params->parity_context ? FLAG_PARITY_CONTEXT : 0) | (block_length ? FLAG_BLOCKS : 0) |
+		               (window ? FLAG_WINDOW : 0);
 	}
 
 public:
+	// Limit imposed by the 16-bit header size field
+	static const int MAX_BLOCKS = (65535 - (sizeof(DataHeader) - 8)) / sizeof(Longword) - 3;
+
+	DataFile() : mapping(NULL), data(NULL), length(0), block_length(0), window(0) {}
+
+	// Refer to data owned by the caller, without copying it
+	DataFile(const unsigned char *bytes, int length) : mapping(NULL), data(bytes), length(length), block_length(0), window(0) {}
+
+	~DataFile() {
+		delete mapping;
+	}
+
+	// Read a stream of unknown length, such as a pipe, into the buffer.
+	// Fails with an error if it is larger than INT_MAX bytes.
+	bool read_stream(FILE *file, const char *filename) {
+		const int chunk_size = 65536;
+		buffer.clear();
+		while (true) {
+			int old_size = buffer.size();
+			int wanted = min(chunk_size, INT_MAX - old_size);
+			if (wanted == 0) {
+				if (fgetc(file) != EOF) report_too_large(filename);
+				break;
+			}
+			buffer.resize(old_size + wanted);
+			int n = fread(&buffer[old_size], 1, wanted, file);
+			buffer.resize(old_size + n);
+			if (n < wanted) break;
+		}
+		if (ferror(file)) return false;
+		use_buffer();
+		return true;
+	}
+
+	// Regular files are mapped into memory rather than read into a buffer.
+	// The name - denotes standard input.
 	void load(const char *filename) {
-		FILE *file;
-		if ((file = fopen(filename, "rb"))) {
-			fseek(file, 0, SEEK_END);
-			int length = ftell(file);
-			fseek(file, 0, SEEK_SET);
-			data.resize(length);
-			if (fread(&data[0], 1, data.size(), file) == data.size()) {
-				fclose(file);
+		if (strcmp(filename, "-") == 0) {
+#ifdef _WIN32
+			_setmode(_fileno(stdin), _O_BINARY);
+#endif
+			if (read_stream(stdin, "<stdin>")) return;
+		} else {
+			MappedFile *file = new MappedFile;
+			if (file->open(filename)) {
+				delete mapping;
+				mapping = file;
+				data = file->data();
+				length = file->size();
 				return;
 			}
+			bool too_large = file->too_large();
+			delete file;
+			if (too_large) {
+				report_too_large(filename);
+			}
+
+			// Not a regular file. Try reading it as a stream.
+			FILE *stream;
+			if ((stream = fopen(filename, "rb"))) {
+				bool ok = read_stream(stream, filename);
+				fclose(stream);
+				if (ok) return;
+			}
 		}
 
-		printf("Error while reading file %s\n\n", filename);
-		exit(1);
+		status("Error while reading file %s\n\n", filename);
+		fatal_error();
 	}
 
+	vector<unsigned char> contents(bool include_header) {
+		vector<unsigned char> bytes;
+		bytes.reserve(size(include_header));
+		if (include_header) {
+			bytes = header_bytes();
+		}
+		bytes.insert(bytes.end(), data, data + length);
+		return bytes;
+	}
+
+	// The header and data are written straight from where they are stored.
+	// The name - denotes standard output.
 	void save(const char *filename, bool write_header) {
+		bool to_stdout = strcmp(filename, "-") == 0;
 		FILE *file;
-		if ((file = fopen(filename, "wb"))) {
-			bool ok = true;
-			if (write_header) {
-				ok = fwrite(&header, 1, sizeof(DataHeader), file) == sizeof(DataHeader);
-			}
-			if (ok && fwrite(&data[0], 1, data.size(), file) == data.size()) {
-				fclose(file);
+#ifdef _WIN32
+		if (to_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+		if ((file = to_stdout ? stdout : fopen(filename, "wb"))) {
+			vector<unsigned char> header_data = header_bytes();
+			bool ok = !write_header || fwrite(&header_data[0], 1, header_data.size(), file) == header_data.size();
+			ok = ok && (length == 0 || fwrite(data, 1, length, file) == length);
+			ok = (to_stdout ? fflush(file) : fclose(file)) == 0 && ok;
+			if (ok) {
 				return;
 			}
 		}
 
-		printf("Error while writing file %s\n\n", filename);
-		exit(1);
+		status("Error while writing file %s\n\n", filename);
+		fatal_error();
+	}
+
+	// Split off the data file header. Returns false if there is no valid header.
+	bool read_header() {
+		if (length < sizeof(DataHeader)) return false;
+		memcpy(&header, data, sizeof(DataHeader));
+		if (memcmp(header.magic, "Shri", 4) != 0) return false;
+		if (header.uncompressed_size > (unsigned) INT_MAX) return false;
+		int header_size = 8 + header.header_size;
+		if (header_size < sizeof(DataHeader) || header_size > length) return false;
+		const unsigned char *extension = data + sizeof(DataHeader);
+		int extension_size = header_size - sizeof(DataHeader);
+		window = 0;
+		if (header.flags & FLAG_WINDOW) {
+			if (extension_size < sizeof(Longword)) return false;
+			window = *(const Longword *) extension;
+			if (window <= 0 || window > Decompressor::MAX_WINDOW) return false;
+			extension += sizeof(Longword);
+			extension_size -= sizeof(Longword);
+		}
+		block_length = 0;
+		if ((header.flags & FLAG_BLOCKS) && !read_block_index(extension, extension_size)) {
+			return false;
+		}
+		data += header_size;
+		length -= header_size;
+		if (header.compressed_size > length) return false;
+		length = header.compressed_size;
+		return true;
+	}
+
+	bool header_parity_context() {
+		return (header.flags & FLAG_PARITY_CONTEXT) != 0;
+	}
+
+	int header_safety_margin() {
+		return header.safety_margin;
+	}
+
+	// Maximum reference offset, or 0 if the data was crunched without a window
+	int header_window() {
+		return window;
 	}
 
 	int size(bool include_header) {
-		return (include_header ? sizeof(DataHeader) : 0) + data.size();
+		return (include_header ? sizeof(DataHeader) + header_extension_size() : 0) + length;
+	}
+
+	// Number of blocks, or 0 for a single stream
+	int block_count() {
+		return block_length ? (int) block_sizes.size() : 0;
+	}
+
+	int block_uncompressed_size(int b) {
+		return min(block_length, (int) header.uncompressed_size - b * block_length);
+	}
+
+	// Offset of a block in the crunched data
+	int block_offset(int b) {
+		int offset = 0;
+		for (int i = 0 ; i < b ; i++) {
+			offset += block_sizes[i];
+		}
+		return offset;
+	}
+
+	// Decrunch a single block. Returns false if it is corrupt.
+	bool decrunch_block(int b, bool parity_context, vector<unsigned char>& out) {
+		out.resize(block_uncompressed_size(b));
+		return decrunch_block(b, parity_context, &out[0]);
+	}
+
+	// Decrunch a single block into the place for it. Returns false if it is corrupt.
+	bool decrunch_block(int b, bool parity_context, unsigned char *out) {
+		Decompressor decompressor(data + block_offset(b), block_sizes[b], LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+		return decompressor.decode(out, block_uncompressed_size(b), parity_context);
 	}
 
-	DataFile* crunch(PackParams *params, RefEdgeFactory *edge_factory, bool show_progress) {
-		vector<unsigned char> pack_buffer = compress(params, edge_factory, show_progress);
-		int margin = verify(params, pack_buffer);
+	DataFile* crunch(PackParams *params, ModelStatistics *stats, RefEdgeFactory *edge_factory, LZProgress *progress) {
+		ReportBlockScope report_scope("data", 0, length);
+		TraceSpan crunch_span("crunch");
+		Counters::take();
+		vector<unsigned char> pack_buffer = compress(params, stats, edge_factory, progress);
+		if (Counters::enabled) {
+			Counters::take().print("data", 0);
+		}
+		int margin = verify(params, data, length, pack_buffer);
 
-		printf("Minimum safety margin for overlapped decrunching: %d\n\n", margin);
+		status("Minimum safety margin for overlapped decrunching: %d\n\n", margin);
 
 		DataFile *ef = new DataFile;
-		ef->data = pack_buffer;
-		ef->header.magic[0] = 'S';
-		ef->header.magic[1] = 'h';
-		ef->header.magic[2] = 'r';
-		ef->header.magic[3] = 'i';
-		ef->header.major_version = SHRINKLER_MAJOR_VERSION;
-		ef->header.minor_version = SHRINKLER_MINOR_VERSION;
-		ef->header.header_size = sizeof(DataHeader) - 8;
-		ef->header.compressed_size = pack_buffer.size();
-		ef->header.uncompressed_size = data.size();
-		ef->header.safety_margin = margin;
-		ef->header.flags = params->parity_context ? FLAG_PARITY_CONTEXT : 0;
+		ef->buffer.swap(pack_buffer);
+		ef->use_buffer();
+		ef->window = params->max_offset;
+		ef->fill_header(params, length, margin);
 
 		return ef;
 	}
+
+	// Crunch the data as independent blocks of the given size, using the
+	// given number of threads. Each thread beyond the first gets a reference
+	// buffer of the same size as the given one. Returns NULL if there would
+	// be too many blocks.
+	DataFile* crunch_blocks(PackParams *params, int block_size, int n_workers, RefEdgeFactory *edge_factory) {
+		int n_blocks = (length + block_size - 1) / block_size;
+		if (n_blocks > MAX_BLOCKS) {
+			return NULL;
+		}
+		TraceSpan crunch_span("crunch");
+		DataFile *ef = new DataFile;
+		ef->block_length = block_size;
+		ef->block_sizes.resize(n_blocks);
+		ef->window = params->max_offset;
+		ef->header.uncompressed_size = length;
+
+		ThreadPool pool(min(n_workers, max(n_blocks, 1)));
+		vector<RefEdgeFactory*> edge_factories(pool.workers(), edge_factory);
+		for (int w = 1 ; w < pool.workers() ; w++) {
+			edge_factories[w] = new RefEdgeFactory(edge_factory->capacity(), edge_factory->file_backed());
+			edge_factories[w]->set_growth_limit(edge_factory->get_growth_limit());
+		}
+		status("Crunching %d blocks of %d bytes using %d workers...\n\n", n_blocks, block_size, pool.workers());
+		status_flush();
+
+		BlockCruncher cruncher(*this, *ef, params, edge_factories);
+		pool.start(&cruncher, n_blocks);
+
+		// Collect the blocks in order. The overlap margin of each block is
+		// measured from the end of the data, where the compressed data ends.
+		int error = 0;
+		int margin = 0;
+		int packed_end = 0;
+		for (int b = 0 ; b < n_blocks ; b++) {
+			pool.wait(b);
+			if (pool.failed(b)) {
+				cruncher.errors[b] = 1;
+			}
+			if (cruncher.errors[b]) {
+				error = max(error, cruncher.errors[b]);
+				continue;
+			}
+			if (Counters::enabled) {
+				cruncher.counters[b].print("block", b);
+			}
+			vector<unsigned char>& packed = cruncher.packed[b];
+			ef->block_sizes[b] = packed.size();
+			ef->buffer.insert(ef->buffer.end(), packed.begin(), packed.end());
+			packed_end += packed.size();
+			int block_end = b * block_size + ef->block_uncompressed_size(b);
+			margin = max(margin, cruncher.margins[b] + block_end - packed_end);
+			vector<unsigned char>().swap(packed);
+		}
+		pool.join();
+		for (int w = 1 ; w < pool.workers() ; w++) {
+			edge_factory->max_edge_count = max(edge_factory->max_edge_count, edge_factories[w]->max_edge_count);
+			edge_factory->max_cleaned_edges = max(edge_factory->max_cleaned_edges, edge_factories[w]->max_cleaned_edges);
+			delete edge_factories[w];
+		}
+		if (error) {
+			delete ef;
+			if (error == 2) throw std::bad_alloc();
+			status("Verify error in block!\n");
+			internal_error();
+		}
+		ef->use_buffer();
+		margin += ef->length - length;
+		ef->fill_header(params, length, margin);
+
+		status("Crunched %d bytes to %d bytes\n\n", length, ef->length);
+		status("Minimum safety margin for overlapped decrunching: %d\n\n", margin);
+
+		return ef;
+	}
+
+	// Write a checkpoint index for seeking in the crunched data
+	int save_checkpoints(const char *filename, int interval) {
+		CheckpointIndex index;
+		if (!index.build(data, length, header_parity_context(), LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, interval)) {
+			internal_error();
+		}
+		if (!index.save(filename)) {
+			status("Error while writing file %s\n\n", filename);
+			fatal_error();
+		}
+		return index.size();
+	}
+
+	// Does the checkpoint index belong to the crunched data?
+	bool index_matches(CheckpointIndex *index, bool parity_context) {
+		return index->matches(data, length, parity_context, LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+	}
+
+	// Decrunch length bytes from position start. Only the blocks covering
+	// the range are decrunched, or with a checkpoint index, only the data
+	// from a nearby checkpoint. Otherwise, all data up to the end of the
+	// range is decrunched. Returns NULL if the compressed data is corrupt.
+	DataFile* decrunch_range(bool parity_context, bool has_header, CheckpointIndex *index, int start, int range_length) {
+		status("Decrunching range... ");
+		status_flush();
+		DataFile *df = new DataFile;
+		bool ok = true;
+		if (has_header && block_length) {
+			start = min(start, (int) header.uncompressed_size);
+			int end = start + min(range_length, (int) header.uncompressed_size - start);
+			vector<unsigned char> block;
+			for (int b = start / block_length ; ok && b * block_length < end ; b++) {
+				ok = decrunch_block(b, parity_context, block);
+				int from = max(start - b * block_length, 0);
+				int to = min(end - b * block_length, (int) block.size());
+				if (ok) df->buffer.insert(df->buffer.end(), block.begin() + from, block.begin() + to);
+			}
+			status(ok ? "OK\n\n" : "\n\n");
+		} else if (index) {
+			int from_pos = 0;
+			ok = start > index->total_size() || index->decode_range(data, start, range_length, df->buffer, &from_pos);
+			status(ok ? "OK, starting from checkpoint at %d\n\n" : "\n\n", from_pos);
+		} else {
+			int max_length = has_header ? (int) header.uncompressed_size : INT_MAX;
+			Decompressor decompressor(data, length, LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+			vector<unsigned char> decoded;
+			int end = (int) min((long long) start + range_length, (long long) INT_MAX);
+			int result = decompressor.decode(decoded, 0, parity_context, max_length, end);
+			ok = result != Decompressor::DECODE_ERROR;
+			if (ok && start < decompressor.position()) {
+				end = min(end, result == Decompressor::DECODE_END ? (int) decoded.size() : end);
+				df->buffer.assign(decoded.begin() + start, decoded.begin() + end);
+			}
+			status(ok ? "OK\n\n" : "\n\n");
+		}
+		if (!ok) {
+			delete df;
+			return NULL;
+		}
+		df->use_buffer();
+		return df;
+	}
+
+	// Decrunch data crunched with a bounded window straight to a file, or
+	// to standard output for the name -, keeping only the window in memory.
+	// Returns the decrunched size, or -1 if the compressed data is corrupt.
+	int decrunch_stream(const char *filename, bool parity_context, bool has_header, int window) {
+		status("Decrunching with a window of %d bytes... ", window);
+		status_flush();
+		int max_length = has_header ? (int) header.uncompressed_size : INT_MAX;
+		bool to_stdout = strcmp(filename, "-") == 0;
+		FILE *file;
+#ifdef _WIN32
+		if (to_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+		if (!(file = to_stdout ? stdout : fopen(filename, "wb"))) {
+			status("\n\nError while writing file %s\n\n", filename);
+			fatal_error();
+		}
+		double start = now();
+		Decompressor decompressor(data, length, LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+		int result = decompressor.decode_ring(file, window, parity_context, max_length);
+		bool write_ok = (to_stdout ? fflush(file) : fclose(file)) == 0 && result != Decompressor::DECODE_WRITE_ERROR;
+		double seconds = now() - start;
+		if (!write_ok) {
+			status("\n\nError while writing file %s\n\n", filename);
+			fatal_error();
+		}
+		int decrunched_length = decompressor.position();
+		if (result != Decompressor::DECODE_END || (has_header && decrunched_length != max_length)) {
+			status("\n\n");
+			return -1;
+		}
+		status("OK\n\n");
+
+		status("Decrunched %d bytes in %.3f seconds", decrunched_length, seconds);
+		if (seconds > 0) {
+			status(" (%.1f MB/s)", decrunched_length / seconds / 1000000.0);
+		}
+		status("\n\n");
+
+		return decrunched_length;
+	}
+
+	// Returns NULL if the compressed data is corrupt.
+	// Blocks are decrunched using the given number of threads.
+	DataFile* decrunch(bool parity_context, bool has_header, int n_workers = 1) {
+		status("Decrunching... ");
+		status_flush();
+		int max_length = has_header ? (int) header.uncompressed_size : INT_MAX;
+		DataFile *df = new DataFile;
+		double start = now();
+		bool ok;
+		if (has_header && block_length) {
+			// Decode directly into a buffer of the final size
+			df->buffer.resize(max_length);
+			ThreadPool pool(min(n_workers, max(block_count(), 1)));
+			BlockDecruncher decruncher(*this, *df, parity_context);
+			pool.start(&decruncher, block_count());
+			pool.join();
+			ok = true;
+			for (int b = 0 ; b < block_count() ; b++) {
+				if (decruncher.errors[b] == 2) {
+					delete df;
+					throw std::bad_alloc();
+				}
+				ok = ok && !decruncher.errors[b] && !pool.failed(b);
+			}
+		} else {
+			// The size in the header is not trusted for allocating the
+			// buffer up front. The buffer grows as the data is decoded.
+			Decompressor decompressor(data, length, LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+			ok = decompressor.decode(df->buffer, parity_context, max_length);
+		}
+		df->use_buffer();
+		double seconds = now() - start;
+		if (!ok || (has_header && df->length != max_length)) {
+			status("\n\n");
+			delete df;
+			return NULL;
+		}
+		status("OK\n\n");
+
+		status("Decrunched %d bytes in %.3f seconds", df->length, seconds);
+		if (seconds > 0) {
+			status(" (%.1f MB/s)", df->length / seconds / 1000000.0);
+		}
+		status("\n\n");
+
+		return df;
+	}
 };
@@ -0,0 +1,423 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Fast decompressor for Shrinkler data on the host.
+
+This decodes the same format as the combination of RangeDecoder and
+LZDecoder used by the verifier, but is built for throughput rather than
+for observing the decoding process:
+
+- The compressed data is fed into the range decoder a byte at a time,
+  into a 64-bit window, rather than one bit at a time.
+- Context decoding and number decoding are inlined, with no virtual calls.
+- References are copied with memcpy when source and destination do not
+  overlap, and byte by byte otherwise.
+
+Decoding can be paused at a symbol boundary, and the complete decoder
+state can be captured in a checkpoint, from which decoding can later be
+resumed without decoding the data before it. To tell which data is needed
+for that, the decompressor can track for each decoded byte the position
+of the literal it was ultimately copied from.
+
+Data compressed with a bounded window can be decoded through a ring
+buffer, writing the output to a file as it is produced, so that memory
+use does not depend on the size of the data.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <vector>
+
+using std::fill;
+using std::max;
+using std::min;
+using std::vector;
+
+#include "LZEncoder.h"
+
+#ifndef ADJUST_SHIFT
+#define ADJUST_SHIFT 4
+#endif
+
+// Complete decoder state at a symbol boundary
+struct DecompressorCheckpoint {
+	int byte_pos;
+	int value_bits;
+	unsigned long long window;
+	unsigned intervalsize;
+	int pos;
+	int offset;
+	bool ref;
+	bool prev_was_ref;
+	vector<unsigned short> contexts;
+};
+
+class Decompressor {
+	vector<unsigned short> contexts;
+	const unsigned char *packed;
+	int packed_size;
+
+	// Read position in the compressed data
+	int byte_pos;
+
+	// Range decoder state. The interval value is kept in the upper part of
+	// the window, followed by value_bits bits not yet shifted in.
+	unsigned long long window;
+	int value_bits;
+	unsigned intervalsize;
+
+	// LZ state between symbols
+	int pos;
+	int offset;
+	bool ref;
+	bool prev_was_ref;
+
+	// Literal origin of every decoded byte, if tracked
+	vector<int> *origins;
+	int min_origin;
+
+	// Whether references may reach data before the start of the output
+	bool missing_allowed;
+
+	void refill() {
+		while (value_bits < 32) {
+			unsigned char byte = byte_pos < packed_size ? packed[byte_pos] : 0;
+			byte_pos++;
+			window = (window << 8) | byte;
+			value_bits += 8;
+		}
+	}
+
+	int decodeBit(int context_index) {
+		if (intervalsize < 0x8000) {
+			if (value_bits < 16) refill();
+			do {
+				intervalsize <<= 1;
+				value_bits--;
+			} while (intervalsize < 0x8000);
+		}
+
+		unsigned prob = contexts[context_index];
+		unsigned threshold = (intervalsize * prob) >> 16;
+		unsigned long long scaled_threshold = (unsigned long long) threshold << value_bits;
+		if (window >= scaled_threshold) {
+			// Zero
+			window -= scaled_threshold;
+			intervalsize -= threshold;
+			contexts[context_index] = prob - (prob >> ADJUST_SHIFT);
+			return 0;
+		} else {
+			// One
+			intervalsize = threshold;
+			contexts[context_index] = prob + (0xffff >> ADJUST_SHIFT) - (prob >> ADJUST_SHIFT);
+			return 1;
+		}
+	}
+
+	// Record the origins of bytes copied by a reference, or of a literal
+	// for an offset of 0
+	void copy_origins(int pos, int offset, int length) {
+		vector<int>& o = *origins;
+		if (o.size() < pos + length) o.resize(max(o.size() * 2, (size_t) pos + length));
+		for (int i = 0 ; i < length ; i++) {
+			o[pos + i] = offset ? o[pos + i - offset] : pos;
+			min_origin = min(min_origin, o[pos + i]);
+		}
+	}
+
+	// Decode into size bytes at dest, which hold the data from position
+	// base. If buffer is given, dest is its contents, and it grows as
+	// needed and is trimmed at the end. Otherwise, running out of room is
+	// an error.
+	int decodeSymbols(unsigned char *dest, int size, vector<unsigned char> *buffer, int base, bool parity_context, int max_length, int stop_pos) {
+		const int lit_base = LZEncoder::NUM_SINGLE_CONTEXTS;
+		const int kind_base = LZEncoder::NUM_SINGLE_CONTEXTS + LZEncoder::CONTEXT_KIND;
+		const int repeated_context = LZEncoder::NUM_SINGLE_CONTEXTS + LZEncoder::CONTEXT_REPEATED;
+		const int offset_base = LZEncoder::NUM_SINGLE_CONTEXTS + (LZEncoder::CONTEXT_GROUP_OFFSET << 8);
+		const int length_base = LZEncoder::NUM_SINGLE_CONTEXTS + (LZEncoder::CONTEXT_GROUP_LENGTH << 8);
+		int parity_mask = parity_context ? 1 : 0;
+
+		int capacity = base + size;
+		while (pos < stop_pos) {
+			if (ref) {
+				bool repeated = false;
+				if (!prev_was_ref) {
+					repeated = decodeBit(repeated_context);
+				}
+				if (!repeated) {
+					offset = decodeNumber(offset_base) - 2;
+					if (offset == 0) {
+						if (buffer) buffer->resize(pos - base);
+						return DECODE_END;
+					}
+				}
+				if (offset <= 0 || offset > pos - base) {
+					if (offset <= 0 || offset > pos || !missing_allowed) return DECODE_ERROR;
+				}
+				int length = decodeNumber(length_base);
+				if (length <= 0 || length > max_length - pos) return DECODE_ERROR;
+				if (pos + length > capacity) {
+					if (!buffer) return DECODE_ERROR;
+					capacity = base + max((capacity - base) * 2, pos + length - base);
+					buffer->resize(capacity - base);
+					dest = &(*buffer)[0];
+				}
+				unsigned char *d = &dest[pos - base];
+				const unsigned char *s = d - offset;
+				if (offset > pos - base) {
+					for (int i = 0 ; i < length ; i++) {
+						d[i] = pos + i - offset >= base ? s[i] : 0;
+					}
+				} else if (offset >= length) {
+					memcpy(d, s, length);
+				} else {
+					for (int i = 0 ; i < length ; i++) {
+						d[i] = s[i];
+					}
+				}
+				if (origins) copy_origins(pos, offset, length);
+				pos += length;
+				prev_was_ref = true;
+			} else {
+				if (pos >= max_length) return DECODE_ERROR;
+				if (pos >= capacity) {
+					if (!buffer) return DECODE_ERROR;
+					capacity = base + (capacity - base) * 2;
+					buffer->resize(capacity - base);
+					dest = &(*buffer)[0];
+				}
+				int context_base = lit_base + ((pos & parity_mask) << 8);
+				int context = 1;
+				for (int i = 0 ; i < 8 ; i++) {
+					context = (context << 1) | decodeBit(context_base + context);
+				}
+				if (origins) copy_origins(pos, 0, 1);
+				dest[pos++ - base] = (unsigned char) context;
+				prev_was_ref = false;
+			}
+			ref = decodeBit(kind_base + ((pos & parity_mask) << 8));
+		}
+		return DECODE_PAUSED;
+	}
+
+public:
+	Decompressor(const unsigned char *packed, int packed_size, int n_contexts)
+		: packed(packed), packed_size(packed_size)
+	{
+		contexts.resize(n_contexts, 0x8000);
+		byte_pos = 0;
+		window = 0;
+		value_bits = 0;
+		intervalsize = 1;
+		pos = 0;
+		offset = 0;
+		ref = false;
+		prev_was_ref = false;
+		origins = NULL;
+		min_origin = INT_MAX;
+		missing_allowed = false;
+	}
+
+	void save(DecompressorCheckpoint& checkpoint) {
+		checkpoint.byte_pos = byte_pos;
+		checkpoint.value_bits = value_bits;
+		checkpoint.window = window;
+		checkpoint.intervalsize = intervalsize;
+		checkpoint.pos = pos;
+		checkpoint.offset = offset;
+		checkpoint.ref = ref;
+		checkpoint.prev_was_ref = prev_was_ref;
+		checkpoint.contexts = contexts;
+	}
+
+	// Continue decoding from a checkpoint taken for the same data
+	void restore(const DecompressorCheckpoint& checkpoint) {
+		byte_pos = checkpoint.byte_pos;
+		value_bits = checkpoint.value_bits;
+		window = checkpoint.window;
+		intervalsize = checkpoint.intervalsize;
+		pos = checkpoint.pos;
+		offset = checkpoint.offset;
+		ref = checkpoint.ref;
+		prev_was_ref = checkpoint.prev_was_ref;
+		contexts = checkpoint.contexts;
+	}
+
+	// Position of the next symbol in the decompressed data
+	int position() {
+		return pos;
+	}
+
+	// Track the literal origin of each byte decoded from position 0 onwards
+	void track_origins(vector<int> *origins) {
+		this->origins = origins;
+	}
+
+	// Lowest literal origin of the bytes decoded since the last call
+	int take_min_origin() {
+		int origin = min_origin;
+		min_origin = INT_MAX;
+		return origin;
+	}
+
+	// Let references reach before the start of the output, reading zeros
+	// there. The output is then only valid for bytes whose literal origin
+	// is within the output.
+	void allow_missing(bool allowed) {
+		missing_allowed = allowed;
+	}
+
+	// Reset context probabilities, as done between hunks
+	void reset() {
+		fill(contexts.begin(), contexts.end(), 0x8000);
+	}
+
+	// Decode a number >= 2 using the variable-length encoding
+	int decodeNumber(int base_context) {
+		int i = 0;
+		while (decodeBit(base_context + (i * 2 + 2))) {
+			if (++i >= 30) return 0;
+		}
+		int number = 1;
+		for (; i >= 0 ; i--) {
+			number = (number << 1) | decodeBit(base_context + (i * 2 + 1));
+		}
+		return number;
+	}
+
+	enum { DECODE_ERROR, DECODE_END, DECODE_PAUSED, DECODE_WRITE_ERROR };
+
+	// Largest window supported when decoding through a ring buffer
+	static const int MAX_WINDOW = 1 << 29;
+
+	// Continue decoding LZ data into out, where out[0] holds the byte at
+	// position base. Decoding pauses before the first symbol at or after
+	// stop_pos. When paused, out may be larger than the decoded data.
+	// When the end is reached, out is trimmed to the decoded data.
+	// Fails if the data is corrupt, longer than max_length or refers to
+	// data before base.
+	int decode(vector<unsigned char>& out, int base, bool parity_context, int max_length, int stop_pos) {
+		if (out.size() < 1024) out.resize(1024);
+		return decodeSymbols(&out[0], out.size(), &out, base, parity_context, max_length, stop_pos);
+	}
+
+	// Decode LZ data with references at most window bytes back, keeping
+	// only the most recent output in a ring buffer and writing the rest to
+	// out. Returns DECODE_END, DECODE_ERROR if the data is corrupt, longer
+	// than max_length or refers outside the window, or DECODE_WRITE_ERROR.
+	// The window must be at most MAX_WINDOW.
+	int decode_ring(FILE *out, int window, bool parity_context, int max_length) {
+		const int lit_base = LZEncoder::NUM_SINGLE_CONTEXTS;
+		const int kind_base = LZEncoder::NUM_SINGLE_CONTEXTS + LZEncoder::CONTEXT_KIND;
+		const int repeated_context = LZEncoder::NUM_SINGLE_CONTEXTS + LZEncoder::CONTEXT_REPEATED;
+		const int offset_base = LZEncoder::NUM_SINGLE_CONTEXTS + (LZEncoder::CONTEXT_GROUP_OFFSET << 8);
+		const int length_base = LZEncoder::NUM_SINGLE_CONTEXTS + (LZEncoder::CONTEXT_GROUP_LENGTH << 8);
+		int parity_mask = parity_context ? 1 : 0;
+
+		// The ring consists of two halves, each at least the window size.
+		// A half is written out when the other half is full, so the
+		// window before the current position is always in the ring.
+		// There is no need for halves larger than the whole output.
+		size_t half = 1024;
+		while (half < (size_t) min(window, max_length)) half <<= 1;
+		int ring_size = (int) (half * 2);
+		int mask = ring_size - 1;
+		vector<unsigned char> ring(ring_size);
+		unsigned char *dest = &ring[0];
+		int flushed = 0;
+
+		pos = 0;
+		offset = 0;
+		ref = false;
+		prev_was_ref = false;
+		while (true) {
+			if (pos - flushed == ring_size) {
+				if (fwrite(&dest[flushed & mask], 1, half, out) != half) return DECODE_WRITE_ERROR;
+				flushed += half;
+			}
+			if (ref) {
+				bool repeated = false;
+				if (!prev_was_ref) {
+					repeated = decodeBit(repeated_context);
+				}
+				if (!repeated) {
+					offset = decodeNumber(offset_base) - 2;
+					if (offset == 0) break;
+				}
+				if (offset <= 0 || offset > pos || offset > window) return DECODE_ERROR;
+				int length = decodeNumber(length_base);
+				if (length <= 0 || length > max_length - pos) return DECODE_ERROR;
+				while (length > 0) {
+					if (pos - flushed == ring_size) {
+						if (fwrite(&dest[flushed & mask], 1, half, out) != half) return DECODE_WRITE_ERROR;
+						flushed += half;
+					}
+					// Copy as much as possible without wrapping or flushing
+					int d = pos & mask;
+					int s = (pos - offset) & mask;
+					int n = min(min(length, ring_size - (pos - flushed)), min(ring_size - d, ring_size - s));
+					if (offset >= n) {
+						memcpy(&dest[d], &dest[s], n);
+					} else {
+						for (int i = 0 ; i < n ; i++) {
+							dest[d + i] = dest[s + i];
+						}
+					}
+					pos += n;
+					length -= n;
+				}
+				prev_was_ref = true;
+			} else {
+				if (pos >= max_length) return DECODE_ERROR;
+				int context_base = lit_base + ((pos & parity_mask) << 8);
+				int context = 1;
+				for (int i = 0 ; i < 8 ; i++) {
+					context = (context << 1) | decodeBit(context_base + context);
+				}
+				dest[pos++ & mask] = (unsigned char) context;
+				prev_was_ref = false;
+			}
+			ref = decodeBit(kind_base + ((pos & parity_mask) << 8));
+		}
+
+		// Write the rest, which may wrap around the end of the ring
+		while (flushed < pos) {
+			int start = flushed & mask;
+			int n = min(pos - flushed, ring_size - start);
+			if (fwrite(&dest[start], 1, n, out) != n) return DECODE_WRITE_ERROR;
+			flushed += n;
+		}
+		return DECODE_END;
+	}
+
+	// Decode one block of LZ data into out, replacing its contents.
+	// Returns false if the data is corrupt or longer than max_length.
+	bool decode(vector<unsigned char>& out, bool parity_context, int max_length) {
+		pos = 0;
+		offset = 0;
+		ref = false;
+		prev_was_ref = false;
+		return decode(out, 0, parity_context, max_length, INT_MAX) == DECODE_END;
+	}
+
+	// Decode one block of LZ data of exactly the given length into out.
+	// Returns false if the data is corrupt or has a different length.
+	bool decode(unsigned char *out, int length, bool parity_context) {
+		pos = 0;
+		offset = 0;
+		ref = false;
+		prev_was_ref = false;
+		return decodeSymbols(out, length, NULL, 0, parity_context, length, INT_MAX) == DECODE_END && pos == length;
+	}
+
+	// Number of compressed bytes consumed so far
+	int bytesRead() {
+		return byte_pos - value_bits / 8;
+	}
+};
@@ -0,0 +1,159 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Distribution of a global time budget across the hunks of an executable.
+
+Each hunk is assigned one of the compression presets (-1 to -9), which
+determines its number of iterations, length margin and match patience.
+All hunks start out at the lowest preset. The scheduler then repeatedly
+raises the preset of the hunk where this gives the largest expected size
+reduction per second spent, for as long as the predicted total time stays
+within the budget. The expected reduction is a fraction of the hunk size,
+so both gain and cost are proportional to the hunk size, and all hunks are
+raised together until the next step for the biggest hunk no longer fits.
+From there on, the smaller hunks can continue towards maximum effort at
+little cost. Empty hunks are not crunched and keep the lowest preset.
+
+The predictions are based on a simple cost model, which is calibrated
+against the wall-clock time actually spent whenever a hunk has been
+crunched. The remaining hunks are then rescheduled to fit the remaining
+budget.
+
+*/
+
+#pragma once
+
+#include <ctime>
+#include <vector>
+#include <algorithm>
+
+#ifndef AMIGA
+#include <chrono>
+#endif
+
+using std::max;
+using std::vector;
+
+#include "Pack.h"
+
+class EffortScheduler {
+	static const int MIN_PRESET = 1;
+	static const int MAX_PRESET = 9;
+
+	// Minimum predicted time (in seconds) before calibration kicks in
+	static constexpr double MIN_CALIBRATION_TIME = 0.1;
+
+	double budget;
+	double calibration;
+	double start_time;
+	int max_preset;
+	vector<int> lengths;
+	vector<int> presets;
+
+	// Typical size reduction (in units of 0.01% of the hunk size) from
+	// raising the preset
+	static int gain(int preset) {
+		static const int gains[MAX_PRESET] = { 0, 225, 37, 37, 9, 7, 7, 3, 3 };
+		return gains[preset];
+	}
+
+	// Approximate time (in seconds) to pack a block with the given preset
+	double cost(int h, int preset) {
+		return calibration * lengths[h] * preset * (4.0 + 1.6 * preset) * 1e-6;
+	}
+
+	static double now() {
+#ifndef AMIGA
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		return clock() / (double) CLOCKS_PER_SEC;
+#endif
+	}
+
+	double elapsed() {
+		return now() - start_time;
+	}
+
+	void plan(int first_hunk, double available) {
+		double total = 0.0;
+		for (int h = first_hunk ; h < lengths.size() ; h++) {
+			presets[h] = MIN_PRESET;
+			total += cost(h, MIN_PRESET);
+		}
+		while (true) {
+			int best_h = -1;
+			double best_gain = 0.0;
+			double best_increase = 0.0;
+			for (int h = first_hunk ; h < lengths.size() ; h++) {
+				if (presets[h] >= max_preset || lengths[h] == 0) continue;
+				double g = gain(presets[h]) * (double) lengths[h];
+				double increase = cost(h, presets[h] + 1) - cost(h, presets[h]);
+				if (total + increase > available) continue;
+				// Compare gain per time, preferring the cheaper step when equal
+				double diff = g * best_increase - best_gain * increase;
+				if (best_h == -1 || diff > 0 || (diff == 0 && increase < best_increase)) {
+					best_h = h;
+					best_gain = g;
+					best_increase = increase;
+				}
+			}
+			if (best_h == -1) break;
+			presets[best_h]++;
+			total += best_increase;
+		}
+	}
+
+public:
+	EffortScheduler(int budget_seconds) : budget(budget_seconds), calibration(1.0), max_preset(MAX_PRESET) {}
+
+	// Make initial schedule for blocks of the given lengths
+	void begin(const vector<int>& lengths) {
+		this->lengths = lengths;
+		presets.resize(lengths.size());
+		calibration = 1.0;
+		max_preset = MAX_PRESET;
+		plan(0, budget);
+
+		// Later rescheduling must stay within the columns of the status table
+		max_preset = MIN_PRESET;
+		for (int h = 0 ; h < presets.size() ; h++) {
+			max_preset = max(max_preset, presets[h]);
+		}
+		start_time = now();
+	}
+
+	// Calibrate the cost model and reschedule the remaining blocks
+	void finished(int h) {
+		double predicted = 0.0;
+		for (int ph = 0 ; ph <= h ; ph++) {
+			predicted += cost(ph, presets[ph]);
+		}
+		double spent = elapsed();
+		if (predicted >= MIN_CALIBRATION_TIME) {
+			calibration *= spent / predicted;
+		}
+		plan(h + 1, budget - spent);
+	}
+
+	// Block was not packed, so it took no time
+	void skipped(int h) {
+		lengths[h] = 0;
+	}
+
+	// Maximum number of iterations of any block
+	int max_iterations() {
+		return max_preset;
+	}
+
+	// Parameters for the given block, based on the parameters not scheduled
+	PackParams params(int h, const PackParams& base) {
+		// Same as the -1, ..., -9 presets
+		int p = presets[h];
+		PackParams params = base;
+		params.iterations = p;
+		params.length_margin = p;
+		params.match_patience = 100 * p;
+		return params;
+	}
+};
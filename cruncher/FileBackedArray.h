@@ -0,0 +1,142 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+An array which can be kept in a temporary file rather than in memory.
+
+A file-backed array is a shared mapping of an unlinked temporary file,
+so its pages can be written out and dropped by the operating system
+under memory pressure instead of counting towards the resident set of
+the process. Elements are accessed through the mapping as if the array
+was in memory. The temporary file is placed in the directory given by
+the TMPDIR environment variable, or /tmp.
+
+Where mapping is not available, or the temporary file cannot be created,
+the array is kept in memory.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(AMIGA)
+#define FILE_BACKED_ARRAY_SUPPORTED
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+using std::string;
+using std::vector;
+
+#include "MemoryTracker.h"
+
+// Elements kept in memory are accounted to the given subsystem
+template <class T, MemorySubsystem S>
+class FileBackedArray {
+	vector<T, TrackedAllocator<T, S> > memory;
+	T *elements;
+	int count;
+#ifdef FILE_BACKED_ARRAY_SUPPORTED
+	void *address;
+	size_t mapped_size;
+
+	void unmap() {
+		if (address) munmap(address, mapped_size);
+		address = NULL;
+		mapped_size = 0;
+	}
+
+	bool map(int n) {
+		const char *dir = getenv("TMPDIR");
+		string path = string(dir && dir[0] ? dir : "/tmp") + "/shrinkler-XXXXXX";
+		vector<char> name(path.begin(), path.end());
+		name.push_back(0);
+		int fd = mkstemp(&name[0]);
+		if (fd < 0) return false;
+		unlink(&name[0]);
+		size_t size = (size_t) n * sizeof(T);
+		if (ftruncate(fd, size) != 0) {
+			close(fd);
+			return false;
+		}
+		void *mapping = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) return false;
+		address = mapping;
+		mapped_size = size;
+		elements = (T *) mapping;
+		return true;
+	}
+#endif
+
+	void release() {
+		vector<T, TrackedAllocator<T, S> >().swap(memory);
+		elements = NULL;
+		count = 0;
+#ifdef FILE_BACKED_ARRAY_SUPPORTED
+		unmap();
+#endif
+	}
+
+	FileBackedArray(const FileBackedArray&);
+	FileBackedArray& operator=(const FileBackedArray&);
+
+public:
+	FileBackedArray() : elements(NULL), count(0) {
+#ifdef FILE_BACKED_ARRAY_SUPPORTED
+		address = NULL;
+		mapped_size = 0;
+#endif
+	}
+
+	~FileBackedArray() {
+#ifdef FILE_BACKED_ARRAY_SUPPORTED
+		unmap();
+#endif
+	}
+
+	// Allocate n zero-initialized elements in a temporary file, discarding
+	// any previous contents. Returns false, leaving the array empty, if the
+	// file could not be set up.
+	bool allocate_file(int n) {
+		release();
+#ifdef FILE_BACKED_ARRAY_SUPPORTED
+		if (n > 0 && map(n)) {
+			count = n;
+			return true;
+		}
+#endif
+		return false;
+	}
+
+	// Allocate n zero-initialized elements, discarding any previous contents.
+	// Returns whether the array ended up backed by a file.
+	bool allocate(int n, bool file_backed) {
+		if (file_backed && allocate_file(n)) return true;
+		release();
+		memory.resize(n);
+		elements = n > 0 ? &memory[0] : NULL;
+		count = n;
+		return false;
+	}
+
+	T& operator[](int i) {
+		return elements[i];
+	}
+
+	const T& operator[](int i) const {
+		return elements[i];
+	}
+
+	T* data() {
+		return elements;
+	}
+
+	int size() const {
+		return count;
+	}
+};
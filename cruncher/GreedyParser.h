@@ -0,0 +1,125 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Parse a data block into LZ symbols using a fast, lazy greedy strategy.
+
+At each position, the parser takes the longest (and closest) match reported
+by the match finder, unless the next position has a match which is longer
+by more than one byte, in which case a literal is emitted first. A match at
+the previous offset is preferred if it is at most one byte shorter.
+
+The parse ignores symbol costs entirely. It is only intended to provide
+initial statistics for the first pass of the optimal parser, in a fraction
+of the time it takes to run the optimal parser with a flat cost model.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+#include "LZParser.h"
+#include "MatchFinder.h"
+
+class GreedyParser {
+	const unsigned char *data;
+	int data_length;
+	int zero_padding;
+	MatchFinder& finder;
+
+	// Find the longest match at pos, preferring the closest one.
+	// Returns the match length, or 0 if no match was found.
+	int longestMatch(int pos, int *offset_out) {
+		finder.beginMatching(pos);
+		int match_pos;
+		int match_length;
+		int best_length = 0;
+		int best_pos = 0;
+		while (finder.nextMatch(&match_pos, &match_length)) {
+			if (best_length > 0 && match_length < best_length) break;
+			best_length = match_length;
+			best_pos = max(best_pos, match_pos);
+		}
+		*offset_out = pos - best_pos;
+		return min(best_length, data_length - pos);
+	}
+
+	// Length of match at pos with the given offset
+	int matchLength(int pos, int offset) {
+		if (offset < 1 || offset > pos) return 0;
+		int length = 0;
+		while (pos + length < data_length && data[pos + length] == data[pos + length - offset]) {
+			length++;
+		}
+		return length;
+	}
+
+public:
+	GreedyParser(const unsigned char *data, int data_length, int zero_padding, MatchFinder& finder)
+		: data(data), data_length(data_length), zero_padding(zero_padding), finder(finder)
+	{}
+
+	LZParseResult parse(LZProgress *progress) {
+		progress->begin(data_length);
+
+		vector<LZResultEdge> edges;
+		int last_offset = 0;
+		bool prev_was_ref = false;
+		int pos = 1;
+		int offset = 0;
+		int length = data_length > 1 ? longestMatch(pos, &offset) : 0;
+		while (pos < data_length) {
+			// Prefer repeated offset
+			if (!prev_was_ref) {
+				int rep_length = matchLength(pos, last_offset);
+				if (rep_length >= 2 && rep_length + 1 >= length) {
+					length = rep_length;
+					offset = last_offset;
+				}
+			}
+
+			// Same offset right after a reference cannot be encoded
+			bool usable = length >= 3 || (length == 2 && offset == last_offset);
+			if (prev_was_ref && offset == last_offset) {
+				usable = false;
+			}
+
+			// Look one position ahead
+			int next_offset = 0;
+			int next_length = 0;
+			if (pos + 1 < data_length) {
+				next_length = longestMatch(pos + 1, &next_offset);
+			}
+
+			if (usable && next_length <= length + 1) {
+				edges.push_back(LZResultEdge(pos, offset, length));
+				last_offset = offset;
+				prev_was_ref = true;
+				pos += length;
+				length = pos < data_length ? longestMatch(pos, &offset) : 0;
+			} else {
+				prev_was_ref = false;
+				pos += 1;
+				offset = next_offset;
+				length = next_length;
+			}
+
+			progress->update(pos);
+		}
+
+		// Result edges are stored in reverse order
+		LZParseResult result;
+		result.data = data;
+		result.data_length = data_length;
+		result.zero_padding = zero_padding;
+		result.edges.assign(edges.rbegin(), edges.rend());
+
+		progress->end();
+
+		return result;
+	}
+};
@@ -13,6 +13,8 @@ The element type must have an accessible _heap_index integer field.
 #include <vector>
 #include <functional>
 
+#include "Counters.h"
+
 using std::vector;
 using std::less;
 
@@ -22,6 +24,7 @@ class Heap {
 	less<T> compare;
 
 	void swap(int i1, int i2) {
+		Counters::add(COUNTER_HEAP_SWAPS);
 		T t1 = elements[i1];
 		T t2 = elements[i2];
 		elements[i1] = t2;
@@ -51,6 +54,7 @@ class Heap {
 	}
 
 	T remove_index(int i) {
+		Counters::add(COUNTER_HEAP_REMOVALS);
 		T removed = elements[i];
 		T last = elements[elements.size()-1];
 		elements[i] = last;
@@ -64,6 +68,7 @@ public:
 	Heap() {}
 
 	void insert(T t) {
+		Counters::add(COUNTER_HEAP_INSERTS);
 		elements.push_back(t);
 		t->_heap_index = elements.size()-1;
 		up(elements.size()-1);
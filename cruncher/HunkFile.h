@@ -10,6 +10,8 @@ hunk merging, crunching and saving.
 #pragma once
 
 #include <cstring>
+#include <climits>
+#include <ctime>
 #include <algorithm>
 #include <string>
 #include <utility>
@@ -24,8 +26,15 @@ using std::string;
 #include "doshunks.h"
 #include "AmigaWords.h"
 #include "DecrunchHeaders.h"
+#include "Status.h"
 #include "Pack.h"
+#include "Report.h"
+#include "Trace.h"
+#include "Counters.h"
+#include "EffortScheduler.h"
+#include "ResultCache.h"
 #include "RangeDecoder.h"
+#include "Decompressor.h"
 #include "LZDecoder.h"
 #include "Verifier.h"
 
@@ -82,50 +91,140 @@ class HunkFile {
 	vector<HunkInfo> hunks;
 	int relocshort_total_size;
 
-	vector<unsigned char> compress_hunks(PackParams *params, bool overlap, bool mini, RefEdgeFactory *edge_factory, bool show_progress) {
+	// Length of hunk data to pack, excluding trailing zeros
+	int packed_data_length(int h) {
+		if (hunks[h].type == HUNK_BSS) return 0;
+		unsigned char *hunk_data = (unsigned char *) &data[hunks[h].datastart];
+		int hunk_data_length = hunks[h].datasize * 4;
+		while (hunk_data_length > 0 && hunk_data[hunk_data_length - 1] == 0) {
+			hunk_data_length--;
+		}
+		return hunk_data_length;
+	}
+
+	// Add everything about a hunk which influences its parse to a cache key
+	void add_to_key(ResultCacheKey& key, int h, unsigned char *hunk_data, int hunk_data_length, int zero_padding) {
+		key.add(hunks[h].type);
+		key.add(hunk_data_length);
+		key.add(zero_padding);
+		key.add(hunk_data, hunk_data_length);
+		if (hunks[h].relocstart != 0) {
+			int spos = hunks[h].relocstart;
+			while (data[spos] != 0) {
+				int rn = data[spos];
+				key.add(&data[spos], (rn + 2) * sizeof(Longword));
+				spos += rn + 2;
+			}
+		}
+	}
+
+	vector<unsigned char> compress_hunks(PackParams *params, EffortScheduler *scheduler, ModelStatistics *stats, ResultCache *cache, bool overlap, bool mini, RefEdgeFactory *edge_factory, LZProgress *progress) {
+		TraceSpan compress_span("compress_hunks");
 		int numhunks = hunks.size();
 
 		vector<unsigned char> pack_buffer;
 		RangeCoder range_coder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 
+		// Distribute effort across hunks
+		int max_iterations = params->iterations;
+		if (scheduler) {
+			vector<int> lengths;
+			for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
+				lengths.push_back(packed_data_length(h));
+			}
+			scheduler->begin(lengths);
+			max_iterations = scheduler->max_iterations();
+		}
+
 		// Print compression status header
 		const char *ordinals[] = { "st", "nd", "rd", "th" };
-		printf("Hunk  Original");
-		for (int p = 1 ; p <= params->iterations ; p++) {
-			printf("  After %d%s pass", p, ordinals[min(p,4)-1]);
+		status("Hunk  ");
+		if (scheduler) {
+			status("Iter Margin Effort  ");
+		}
+		status("Original");
+		for (int p = 1 ; p <= max_iterations ; p++) {
+			status("  After %d%s pass", p, ordinals[min(p,4)-1]);
 		}
 		if (!mini) {
-			printf("      Relocs");
+			status("      Relocs");
 		}
-		printf("\n");
+		status("\n");
 
 		// Crunch the hunks, one by one.
+		vector<CounterSet> hunk_counters;
 		for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
-			printf("%4d  ", h);
+			TraceSpan hunk_span("hunk", "hunk", h);
+			Counters::take();
+			PackParams hunk_params = *params;
+			status("%4d  ", h);
+			if (scheduler) {
+				hunk_params = scheduler->params(h, *params);
+				status("%4d %6d %6d  ", hunk_params.iterations, hunk_params.length_margin, hunk_params.match_patience);
+			}
 			range_coder.reset();
-			switch (hunks[h].type) {
-			case HUNK_CODE:
-			case HUNK_DATA:
-				{
-					// Pack data
-					unsigned char *hunk_data = (unsigned char *) &data[hunks[h].datastart];
-					int hunk_data_length = hunks[h].datasize * 4;
-					// Trim trailing zeros
-					while (hunk_data_length > 0 && hunk_data[hunk_data_length - 1] == 0) {
-						hunk_data_length--;
+			CountingCoder initial_counts(LZEncoder::NUM_CONTEXTS);
+			CountingCoder final_counts(LZEncoder::NUM_CONTEXTS);
+			// Empty hunks are signalled by NULL data pointer
+			unsigned char *hunk_data = NULL;
+			int hunk_data_length = 0;
+			if (hunks[h].type != HUNK_BSS) {
+				hunk_data = (unsigned char *) &data[hunks[h].datastart];
+				hunk_data_length = packed_data_length(h);
+			}
+			int zero_padding = mini ? 0 : hunks[h].memsize * 4 - hunk_data_length;
+			ReportBlockScope report_scope("hunk", h, hunk_data_length);
+			bool seeded = stats && stats->seed(h, hunks[h].type, hunk_data_length, &initial_counts);
+
+			// Look for cached result
+			bool cached = false;
+			int passes = hunk_params.iterations;
+			ResultCacheKey key;
+			if (cache) {
+				add_to_key(key, h, hunk_data, hunk_data_length, zero_padding);
+				key.add(mini);
+				key.add(hunk_params);
+				key.add(*edge_factory);
+				if (seeded) {
+					key.add(initial_counts);
+				}
+				LZParseResult result;
+				if (cache->lookup(key, hunk_data, hunk_data_length, zero_padding, edge_factory, &result, &final_counts)) {
+					result_size_t size = result.encode(LZEncoder(&range_coder, hunk_params.parity_context));
+					status("%8d  %14.3f", hunk_data_length, size / (double) (8 << Coder::BIT_PRECISION));
+					cached = true;
+					passes = 1;
+					if (report_block()) {
+						report_block()->cached = true;
+					}
+					if (scheduler) {
+						scheduler->skipped(h);
 					}
-					int zero_padding = mini ? 0 : hunks[h].memsize * 4 - hunk_data_length;
-					packData(hunk_data, hunk_data_length, zero_padding, params, &range_coder, edge_factory, show_progress);
 				}
-				break;
-			default:
-				int zero_padding = mini ? 0 : hunks[h].memsize * 4;
-				packData(NULL, 0, zero_padding, params, &range_coder, edge_factory, show_progress);
-				break;
+			}
+
+			// Pack data
+			if (!cached) {
+				LZParseResult result = packData(hunk_data, hunk_data_length, zero_padding, &hunk_params, &range_coder, edge_factory, progress,
+				                                seeded ? &initial_counts : NULL, &final_counts);
+				if (cache) {
+					cache->store(key, result, edge_factory, &final_counts);
+				}
+			}
+
+			if (stats) {
+				stats->record(h, hunks[h].type, hunk_data_length, &final_counts);
+			}
+			if (scheduler) {
+				scheduler->finished(h);
+			}
+			for (int p = passes ; p < max_iterations ; p++) {
+				status("%16s", "");
 			}
 
 			if (!mini) {
 				// Reloc table
+				TraceSpan relocs_span("relocs");
 				int reloc_size = 0;
 				for (int rh = 0 ; rh < numhunks ; rh++) {
 					vector<int> offsets;
@@ -148,21 +247,30 @@ class HunkFile {
 						int offset = offsets[ri];
 						int delta = offset - last_offset;
 						if (delta < 4) {
-							printf("\n\nError in input file: overlapping reloc entries.\n\n");
-							exit(1);
+							status("\n\nError in input file: overlapping reloc entries.\n\n");
+							fatal_error();
 						}
 						reloc_size += range_coder.encodeNumber(LZEncoder::NUM_CONTEXTS, delta);
 						last_offset = offset;
 					}
 					reloc_size += range_coder.encodeNumber(LZEncoder::NUM_CONTEXTS, 2);
 				}
-				printf("  %10.3f", reloc_size / (double) (8 << Coder::BIT_PRECISION));
+				status("  %10.3f", reloc_size / (double) (8 << Coder::BIT_PRECISION));
 			}
-			printf("\n");
-			fflush(stdout);
+			if (cached) {
+				status("  (cached)");
+			}
+			status("\n");
+			status_flush();
+			hunk_counters.push_back(Counters::take());
 		}
 		range_coder.finish();
-		printf("\n");
+		status("\n");
+		if (Counters::enabled) {
+			for (int h = 0 ; h < hunk_counters.size() ; h++) {
+				hunk_counters[h].print("hunk", h);
+			}
+		}
 
 		// Round up compressed size to a whole number of longwords
 		pack_buffer.resize((pack_buffer.size() + 3) & -4, 0);
@@ -173,8 +281,9 @@ class HunkFile {
 		int numhunks = hunks.size();
 		vector<pair<int,int> > count_and_hunksize;
 
-		printf("Verifying... ");
-		fflush(stdout);
+		TraceSpan verify_span("verify");
+		status("Verifying... ");
+		status_flush();
 		RangeDecoder decoder(LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS, pack_buffer);
 		LZDecoder lzd(&decoder, true);
 		for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
@@ -195,6 +304,8 @@ class HunkFile {
 			}
 
 			// Verify data
+			TraceSpan hunk_span("verify_hunk", "hunk", h);
+			Stopwatch stopwatch;
 			bool error = false;
 			LZVerifier verifier(h, hunk_data, hunk_data_length, hunks[h].memsize * sizeof(Longword), sizeof(Longword));
 			decoder.reset();
@@ -205,7 +316,7 @@ class HunkFile {
 
 			// Check length
 			if (!error && !mini && verifier.size() != hunks[h].memsize * sizeof(Longword)) {
-				printf("Verify error: hunk %d has incorrect length (%d, should have been %d)!\n", h, verifier.size(), hunk_data_length);
+				status("Verify error: hunk %d has incorrect length (%d, should have been %d)!\n", h, verifier.size(), hunk_data_length);
 				error = true;
 			}
 
@@ -223,27 +334,70 @@ class HunkFile {
 				}
 			}
 
+			BlockReport *block_report = report_current() ? report_current()->find_block("hunk", h) : NULL;
+			if (block_report) {
+				block_report->verify = stopwatch.elapsed();
+			}
+
 			int margin = verifier.front_overlap_margin;
 			int count = verifier.compressed_read_count;
 			int min_hunksize = (margin == 0 ? 1 : (margin + 3) / 4) + count;
 			count_and_hunksize.push_back(make_pair(count, min_hunksize));
 		}
-		printf("OK\n\n");
+		status("OK\n\n");
 
 		return count_and_hunksize;
 	}
 
+	// Match the contents of a hunk against a decrunch header, allowing for
+	// inserted flashing code and for up to two longwords patched during
+	// crunching. Returns the length of the header in the file in longwords,
+	// or 0 if it does not match.
+	int match_header(int h, const unsigned char *header, int header_size, int patch1 = -1, int patch2 = -1) {
+		if (hunks[h].type != HUNK_CODE) return 0;
+		const Longword *content = &data[hunks[h].datastart];
+		const Longword *expected = (const Longword *) header;
+		int n = header_size / sizeof(Longword);
+		for (int flash = 0 ; flash <= 1 ; flash++) {
+			if (hunks[h].datasize < n + flash) break;
+			if (flash && *(const Word *) &content[n - 10] != 0x33C3) break;
+			bool match = true;
+			for (int i = 0 ; match && i < n ; i++) {
+				if (i == patch1 || i == patch2 || (flash && i == n - 10)) continue;
+				int fi = flash && i >= n - 9 ? i + 1 : i;
+				match = (unsigned) content[fi] == (unsigned) expected[i];
+			}
+			if (match) return n + flash;
+		}
+		return 0;
+	}
+
+	// Append hunk contents to a packed stream, optionally in reverse longword order
+	void append_packed(vector<unsigned char>& packed, int h, int skip, bool reverse) {
+		int length = hunks[h].datasize - skip;
+		const Longword *content = &data[hunks[h].datastart + skip];
+		for (int i = 0 ; i < length ; i++) {
+			const Longword& lw = content[reverse ? length - 1 - i : i];
+			packed.insert(packed.end(), (const unsigned char *) &lw, (const unsigned char *) (&lw + 1));
+		}
+	}
+
 public:
 	void load(const char *filename) {
 		FILE *file;
 		if ((file = fopen(filename, "rb"))) {
 			fseek(file, 0, SEEK_END);
-			int length = ftell(file);
+			long length = ftell(file);
 			fseek(file, 0, SEEK_SET);
+			if (length < 0 || length > INT_MAX) {
+				status("File %s is too large!\n\n", filename);
+				fclose(file);
+				fatal_error();
+			}
 			if (length & 3) {
-				printf("File %s has an illegal size!\n\n", filename);
+				status("File %s has an illegal size!\n\n", filename);
 				fclose(file);
-				exit(1);
+				fatal_error();
 			}
 			data.resize(length / 4);
 			if (fread(&data[0], 4, data.size(), file) == data.size()) {
@@ -252,8 +406,8 @@ public:
 			}
 		}
 
-		printf("Error while reading file %s\n\n", filename);
-		exit(1);
+		status("Error while reading file %s\n\n", filename);
+		fatal_error();
 	}
 
 	void save(const char *filename) {
@@ -265,8 +419,8 @@ public:
 			}
 		}
 
-		printf("Error while writing file %s\n\n", filename);
-		exit(1);
+		status("Error while writing file %s\n\n", filename);
+		fatal_error();
 	}
 
 	int size() {
@@ -278,26 +432,26 @@ public:
 		int length = data.size();
 
 		if (data[index++] != HUNK_HEADER) {
-			printf("No hunk header!\n");
+			status("No hunk header!\n");
 			return false;
 		}
 
 		while (data[index++]) {
 			index += data[index];
 			if (index >= length) {
-				printf("Bad hunk header!\n");
+				status("Bad hunk header!\n");
 				return false;
 			}
 		}
 
 		int numhunks = data[index++];
 		if (numhunks == 0) {
-			printf("No hunks!\n");
+			status("No hunks!\n");
 			return false;
 		}
 
 		if (data[index++] != 0 || data[index++] != numhunks-1) {
-			printf("Unsupported hunk load limits!\n");
+			status("Unsupported hunk load limits!\n");
 			return false;
 		}
 
@@ -311,7 +465,7 @@ public:
 			case HUNKF_FAST:
 				break;
 			default:
-				printf("Illegal hunk flags!\n");
+				status("Illegal hunk flags!\n");
 				return false;
 			}
 			index++;
@@ -320,7 +474,7 @@ public:
 		relocshort_total_size = 0;
 
 		// Parse hunks
-		printf("Hunk  Mem  Type  Mem size  Data size  Data sum  Relocs\n");
+		status("Hunk  Mem  Type  Mem size  Data size  Data sum  Relocs\n");
 		for (int h = 0, nh = 0 ; h < numhunks ;) {
 			unsigned flags = hunks[h].flags, type;
 			int hunk_length, symlen, n_symbols;
@@ -329,20 +483,20 @@ public:
 			const char *note = "";
 			while (lh == h) {
 				if (index >= length) {
-					printf("\nUnexpected end of file!\n");
+					status("\nUnexpected end of file!\n");
 					return false;
 				}
 				type = data[index++] & 0x0fffffff;
 				if (index >= length && type != HUNK_END) {
-					printf("\nUnexpected end of file!\n");
+					status("\nUnexpected end of file!\n");
 					return false;
 				}
 
 				if (missing_relocs && type != HUNK_RELOC32 && type != HUNK_RELOC32SHORT && type != HUNK_DREL32) {
 					if (hunks[h].relocentries > 0) {
-						printf("  %6d%s\n", hunks[h].relocentries, note);
+						status("  %6d%s\n", hunks[h].relocentries, note);
 					} else {
-						printf("        %s\n", note);
+						status("        %s\n", note);
 					}
 					note = "";
 					missing_relocs = false;
@@ -351,7 +505,7 @@ public:
 				case HUNK_UNIT:
 				case HUNK_NAME:
 				case HUNK_DEBUG:
-					printf("           %s (skipped)\n",hunktype[type-HUNK_UNIT]);
+					status("           %s (skipped)\n",hunktype[type-HUNK_UNIT]);
 					hunk_length = data[index++];
 					index += hunk_length;
 					break;
@@ -363,7 +517,7 @@ public:
 						index += symlen+1;
 						symlen = data[index++];
 					}
-					printf("           SYMBOL (%d entries)\n", n_symbols);
+					status("           SYMBOL (%d entries)\n", n_symbols);
 					break;
 				case HUNK_CODE:
 				case HUNK_DATA:
@@ -375,7 +529,7 @@ public:
 					}
 					hunks[h].type = type;
 					hunks[h].datasize = data[index++];
-					printf("%4d  %s %4s%10d %10d",
+					status("%4d  %s %4s%10d %10d",
 						h, flags == HUNKF_CHIP ? "CHIP" : flags == HUNKF_FAST ? "FAST" : "ANY ",
 						hunktype[type-HUNK_UNIT], hunks[h].memsize*4, hunks[h].datasize*4);
 					if (type != HUNK_BSS) {
@@ -386,9 +540,9 @@ public:
 							for (int pos = hunks[h].datastart ; pos < hunks[h].datastart+hunks[h].datasize ; pos++) {
 								sum += data[pos];
 							}
-							printf("  %08x", sum);
+							status("  %08x", sum);
 						} else {
-							printf("          ");
+							status("          ");
 						}
 					}
 					if (hunks[h].datasize > hunks[h].memsize) {
@@ -400,7 +554,7 @@ public:
 					break;
 				case HUNK_RELOC32:
 					if (hunks[h].relocstart != 0) {
-						printf("\nMultiple reloc tables!\n");
+						status("\nMultiple reloc tables!\n");
 						return false;
 					}
 					hunks[h].relocstart = index;
@@ -408,13 +562,13 @@ public:
 						int n;
 						while ((n = data[index++]) != 0) {
 							if (n < 0 || index+n+2 >= length || data[index++] >= numhunks) {
-								printf("\nError in reloc table!\n");
+								status("\nError in reloc table!\n");
 								return false;
 							}
 							hunks[h].relocentries += n;
 							while (n--) {
 								if (data[index++] > hunks[h].memsize*4-4) {
-									printf("\nError in reloc table!\n");
+									status("\nError in reloc table!\n");
 									return false;
 								}
 							}
@@ -425,7 +579,7 @@ public:
 				case HUNK_RELOC32SHORT:
 				case HUNK_DREL32:
 					if (hunks[h].relocshortstart != 0) {
-						printf("\nMultiple reloc tables!\n");
+						status("\nMultiple reloc tables!\n");
 						return false;
 					}
 					hunks[h].relocshortstart = index;
@@ -435,13 +589,13 @@ public:
 						int n;
 						while ((n = word_data[word_index++]) != 0) {
 							if (n < 0 || index + (word_index+n+2)/2+1 >= length || word_data[word_index++] >= numhunks) {
-								printf("\nError in reloc table!\n");
+								status("\nError in reloc table!\n");
 								return false;
 							}
 							hunks[h].relocentries += n;
 							while (n--) {
 								if (word_data[word_index++] > hunks[h].memsize*4-4) {
-									printf("\nError in reloc table!\n");
+									status("\nError in reloc table!\n");
 									return false;
 								}
 							}
@@ -453,7 +607,7 @@ public:
 					break;
 				case HUNK_END:
 					if (hunks[h].type == 0) {
-						printf("Empty%9d\n", hunks[h].memsize*4);
+						status("Empty%9d\n", hunks[h].memsize*4);
 						return false;
 					}
 					h = h+1; nh = h;
@@ -470,19 +624,19 @@ public:
 				case HUNK_INDEX:
 				case HUNK_RELRELOC32:
 				case HUNK_ABSRELOC16:
-					printf("           %s (unsupported)\n",hunktype[type-HUNK_UNIT]);
+					status("           %s (unsupported)\n",hunktype[type-HUNK_UNIT]);
 					return false;
 				default:
-					printf("           Unknown (%08X)\n",type);
+					status("           Unknown (%08X)\n",type);
 					return false;
 				}
 			}
 		}
 
 		if (index < length) {
-			printf("Warning: %d bytes of extra data at the end of the file!\n", (length-index)*4);
+			status("Warning: %d bytes of extra data at the end of the file!\n", (length-index)*4);
 		}
-		printf("\n");
+		status("\n");
 		return true;
 	}
 
@@ -695,6 +849,7 @@ public:
 		// There must be a HUNK_END after last hunk!
 		ef->data[dpos++] = HUNK_END;
 		// Note resulting file size
+		if (dpos > bufsize) internal_error();
 		ef->data.resize(dpos);
 
 		return ef;
@@ -712,7 +867,8 @@ public:
 		return true;
 	}
 
-	HunkFile* crunch(PackParams *params, bool overlap, bool mini, bool commandline, string *decrunch_text, unsigned flash_address, RefEdgeFactory *edge_factory, bool show_progress) {
+	HunkFile* crunch(PackParams *params, EffortScheduler *scheduler, ModelStatistics *stats, ResultCache *cache, bool overlap, bool mini, bool commandline, string *decrunch_text, unsigned flash_address, RefEdgeFactory *edge_factory, LZProgress *progress) {
+		TraceSpan crunch_span("crunch");
 		int numhunks = hunks.size();
 
 		// Pad empty hunks
@@ -720,19 +876,25 @@ public:
 		for (int h = 0 ; h < numhunks ; h++) {
 			if (hunks[h].memsize == 0) {
 				hunks[h].memsize = 1;
-				printf("Mem size of hunk %d forced to 4.\n", h);
+				status("Mem size of hunk %d forced to 4.\n", h);
 				forced = true;
 			}
 		}
 		if (forced) {
-			printf("\n");
+			status("\n");
 		}
 
-		vector<unsigned char> pack_buffer = compress_hunks(params, overlap, mini, edge_factory, show_progress);
+		vector<unsigned char> pack_buffer = compress_hunks(params, scheduler, stats, cache, overlap, mini, edge_factory, progress);
 		vector<pair<int,int> > count_and_hunksize = verify(pack_buffer, overlap, mini);
 
 		int newnumhunks = numhunks+1;
-		int bufsize = data.size() * 11 / 10 + 1000;
+
+		// Size the output for the hunk structure, the largest combination of
+		// decrunch headers, the decrunch text and the compressed data.
+		int headers_size = max(sizeof(Header1T) + sizeof(Header2C),
+		                       max(sizeof(OverlapHeaderCT), sizeof(MiniHeaderC))) / sizeof(Longword);
+		int text_size = decrunch_text ? (decrunch_text->length() + 3) / sizeof(Longword) : 0;
+		int bufsize = 5 + numhunks * 4 + 6 + headers_size + text_size + 1 + pack_buffer.size() / 4 + 1;
 
 		HunkFile *ef = new HunkFile;
 		ef->data.resize(bufsize, 0);
@@ -917,8 +1079,8 @@ public:
 			// Set size of data in header
 			int offset = (int) *offsetp + pack_buffer.size();
 			if (offset > 32767) {
-				printf("Size overflow: final size in mini mode must be less than 24k.\n\n");
-				exit(1);
+				status("Size overflow: final size in mini mode must be less than 24k.\n\n");
+				fatal_error();
 			}
 			*offsetp = offset;
 		} else {
@@ -935,8 +1097,142 @@ public:
 		// There must be a HUNK_END after last hunk!
 		ef->data[dpos++] = HUNK_END;
 		// Note resulting file size
+		if (dpos > bufsize) internal_error();
 		ef->data.resize(dpos);
 
 		return ef;
 	}
+
+	// Reconstruct the original executable from a crunched one.
+	// The hunk types of the original are not stored in the crunched file for
+	// the first hunk and in overlap mode. These hunks are restored as CODE
+	// for the first hunk, BSS for all-zero hunks and DATA for the rest.
+	HunkFile* decrunch() {
+		int numhunks = hunks.size() - 1;
+		if (numhunks < 1) return NULL;
+
+		// Identify layout and extract compressed data
+		vector<unsigned char> packed;
+		vector<int> hunk_index(numhunks);
+		bool mini = false;
+		bool overlap = false;
+		int header_length;
+		if ((header_length = match_header(numhunks, Header2, sizeof(Header2))) ||
+		    (header_length = match_header(numhunks, Header2C, sizeof(Header2C)))) {
+			status("Decrunching executable with separate decrunch header...\n\n");
+			append_packed(packed, numhunks, header_length, true);
+			for (int h = 0 ; h < numhunks ; h++) hunk_index[h] = h;
+		} else if ((header_length = match_header(0, MiniHeader, sizeof(MiniHeader), 3)) ||
+		           (header_length = match_header(0, MiniHeaderC, sizeof(MiniHeaderC), 3))) {
+			status("Decrunching executable in mini mode...\n\n");
+			append_packed(packed, 0, header_length, true);
+			for (int h = 0 ; h < numhunks ; h++) hunk_index[h] = h + 1;
+			mini = true;
+		} else if (match_header(0, OverlapHeader, sizeof(OverlapHeader)) ||
+		           match_header(0, OverlapHeaderC, sizeof(OverlapHeaderC)) ||
+		           match_header(0, OverlapHeaderT, sizeof(OverlapHeaderT), 3 + 5, 3 + 6) ||
+		           match_header(0, OverlapHeaderCT, sizeof(OverlapHeaderCT), 4 + 5, 4 + 6)) {
+			status("Decrunching executable in overlap mode...\n\n");
+			for (int h = 0 ; h < numhunks ; h++) {
+				if (hunks[h + 1].type != HUNK_DATA || hunks[h + 1].datasize < 1) return NULL;
+				append_packed(packed, h + 1, 1, false);
+				hunk_index[h] = h + 1;
+			}
+			overlap = true;
+		} else {
+			return NULL;
+		}
+
+		// Decode hunks and relocations
+		vector<vector<unsigned char> > hunk_data(numhunks);
+		vector<vector<vector<int> > > relocs(numhunks, vector<vector<int> >(numhunks));
+		clock_t start = clock();
+		long long total_size = 0;
+		Decompressor decompressor(packed.empty() ? NULL : &packed[0], packed.size(), LZEncoder::NUM_CONTEXTS + NUM_RELOC_CONTEXTS);
+		for (int h = 0 ; h < (mini ? 1 : numhunks) ; h++) {
+			int max_length = hunks[hunk_index[h]].memsize * 4;
+			decompressor.reset();
+			if (!decompressor.decode(hunk_data[h], true, max_length) || (!mini && (hunk_data[h].size() & 3))) {
+				status("Error: Compressed data for hunk %d is corrupt.\n\n", h);
+				fatal_error();
+			}
+			total_size += hunk_data[h].size();
+			if (!mini) {
+				int hunk_length = hunk_data[h].size();
+				for (int rh = 0 ; rh < numhunks ; rh++) {
+					int offset = -4;
+					int delta;
+					while ((delta = decompressor.decodeNumber(LZEncoder::NUM_CONTEXTS)) != 2) {
+						offset += delta;
+						if (delta < 4 || offset > hunk_length - 4) {
+							status("Error: Relocation table for hunk %d is corrupt.\n\n", h);
+							fatal_error();
+						}
+						relocs[h][rh].push_back(offset);
+					}
+				}
+			}
+		}
+		double seconds = (clock() - start) / (double) CLOCKS_PER_SEC;
+		status("Decrunched %lld bytes in %.3f seconds", total_size, seconds);
+		if (seconds > 0) {
+			status(" (%.1f MB/s)", total_size / seconds / 1000000.0);
+		}
+		status("\n\n");
+
+		// Build hunk file
+		HunkFile *ef = new HunkFile;
+		ef->data.push_back(HUNK_HEADER);
+		ef->data.push_back(0);
+		ef->data.push_back(numhunks);
+		ef->data.push_back(0);
+		ef->data.push_back(numhunks - 1);
+		vector<int> memsizes(numhunks);
+		for (int h = 0 ; h < numhunks ; h++) {
+			memsizes[h] = mini ? hunks[hunk_index[h]].memsize : hunk_data[h].size() / 4;
+			ef->data.push_back(memsizes[h] | hunks[hunk_index[h]].flags);
+		}
+		for (int h = 0 ; h < numhunks ; h++) {
+			vector<unsigned char>& bytes = hunk_data[h];
+			int data_length = bytes.size();
+			while (data_length > 0 && bytes[data_length - 1] == 0) {
+				data_length--;
+			}
+			unsigned type;
+			if (h == 0) {
+				type = HUNK_CODE;
+			} else if (overlap) {
+				type = data_length > 0 ? HUNK_DATA : HUNK_BSS;
+			} else {
+				type = hunks[hunk_index[h]].type;
+			}
+			ef->data.push_back(type);
+			if (type == HUNK_BSS) {
+				ef->data.push_back(memsizes[h]);
+			} else {
+				int datasize = (data_length + 3) / 4;
+				bytes.resize(datasize * 4, 0);
+				ef->data.push_back(datasize);
+				ef->data.insert(ef->data.end(), (Longword *) bytes.data(), (Longword *) (bytes.data() + bytes.size()));
+			}
+			bool has_relocs = false;
+			for (int rh = 0 ; rh < numhunks ; rh++) {
+				vector<int>& offsets = relocs[h][rh];
+				if (offsets.empty()) continue;
+				if (!has_relocs) {
+					ef->data.push_back(HUNK_RELOC32);
+					has_relocs = true;
+				}
+				ef->data.push_back(offsets.size());
+				ef->data.push_back(rh);
+				ef->data.insert(ef->data.end(), offsets.begin(), offsets.end());
+			}
+			if (has_relocs) {
+				ef->data.push_back(0);
+			}
+			ef->data.push_back(HUNK_END);
+		}
+
+		return ef;
+	}
 };
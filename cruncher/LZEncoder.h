@@ -67,7 +67,7 @@ class LZState {
 	unsigned after_first:1;
 	unsigned prev_was_ref:1;
 	unsigned parity:1;
-	unsigned last_offset:28;
+	unsigned last_offset;
 
 	friend class LZEncoder;
 };
@@ -96,6 +96,7 @@ class LZEncoder {
 	}
 
 	friend class LZDecoder;
+	friend class Decompressor;
 
 public:
 	static const int KIND_LIT = 0;
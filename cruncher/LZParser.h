@@ -47,8 +47,11 @@ using std::vector;
 
 #include "LZEncoder.h"
 #include "MatchFinder.h"
+#include "FileBackedArray.h"
 #include "Heap.h"
 #include "CuckooHash.h"
+#include "Counters.h"
+#include "MemoryTracker.h"
 #include "assert.h"
 
 // For each offset:
@@ -58,11 +61,11 @@ class RefEdge {
 	int pos;
 	int offset;
 	int length;
-	int total_size;
 	int refcount;
+	long long total_size;
 	RefEdge *source;
 
-	RefEdge(int pos, int offset, int length, int total_size, RefEdge *source)
+	RefEdge(int pos, int offset, int length, long long total_size, RefEdge *source)
 		: pos(pos), offset(offset), length(length), total_size(total_size), source(source)
 	{
 		assert(source != this);
@@ -79,6 +82,7 @@ class RefEdge {
 
 	friend class RefEdgeFactory;
 	friend class LZParser;
+	friend class BeamParser;
 	friend struct LZResultEdge;
 	friend class LZParseResult;
 	friend struct std::less<RefEdge*>;
@@ -95,40 +99,74 @@ namespace std {
 	};
 }
 
-// Factory for RefEdge objects which recycles destroyed objects for efficiency
+// Factory for RefEdge objects which recycles destroyed objects for efficiency.
+// The objects can be kept in an arena in a temporary file, so that edges
+// not touched for a while can be paged out rather than held in memory.
+// Recycled objects are reused first, keeping the working set small.
+// The capacity can grow between passes when edges had to be discarded.
 class RefEdgeFactory {
+	// Uninitialized storage for one edge
+	struct EdgeSlot {
+		long long storage[(sizeof(RefEdge) + sizeof(long long) - 1) / sizeof(long long)];
+	};
+
 	int edge_capacity;
 	int edge_count;
 	int cleaned_edges;
+	int pass_max_edges;
+	int growth_limit;
 
 	RefEdge* buffer;
+	FileBackedArray<EdgeSlot, MEMORY_REFERENCE_EDGES> arena;
+	int arena_used;
+
+	bool in_arena(RefEdge *edge) {
+		EdgeSlot *slot = (EdgeSlot *) edge;
+		return arena.size() > 0 && slot >= arena.data() && slot < arena.data() + arena.size();
+	}
+
 public:
 	int max_edge_count;
 	int max_cleaned_edges;
+	vector<int> resizes; // Capacities grown to
 
-	RefEdgeFactory(int edge_capacity) : edge_capacity(edge_capacity),
-		edge_count(0), cleaned_edges(0), max_edge_count(0), max_cleaned_edges(0)
+	RefEdgeFactory(int edge_capacity, bool file_backed = false) : edge_capacity(edge_capacity),
+		edge_count(0), cleaned_edges(0), pass_max_edges(0), growth_limit(0), arena_used(0), max_edge_count(0), max_cleaned_edges(0)
 	{
 		buffer = NULL;
+		if (file_backed) {
+			// Without a file, edges are allocated individually as usual
+			arena.allocate_file(edge_capacity);
+		}
 	}
 
 	~RefEdgeFactory() {
 		while (buffer != NULL) {
 			RefEdge *edge = buffer;
 			buffer = buffer->source;
-			delete edge;
+			if (!in_arena(edge)) {
+				delete edge;
+				MemoryTracker::freed(MEMORY_REFERENCE_EDGES, sizeof(RefEdge));
+			}
 		}
 	}
 
 	void reset() {
 		assert(edge_count == 0);
 		cleaned_edges = 0;
+		pass_max_edges = 0;
 	}
 
-	RefEdge* create(int pos, int offset, int length, int total_size, RefEdge *source) {
+	RefEdge* create(int pos, int offset, int length, long long total_size, RefEdge *source) {
 		max_edge_count = max(max_edge_count, ++edge_count);
+		pass_max_edges = max(pass_max_edges, edge_count);
 		if (buffer == NULL) {
-			return new RefEdge(pos, offset, length, total_size, source);
+			if (arena_used < arena.size()) {
+				return new (&arena[arena_used++]) RefEdge(pos, offset, length, total_size, source);
+			}
+			RefEdge *edge = new RefEdge(pos, offset, length, total_size, source);
+			MemoryTracker::allocated(MEMORY_REFERENCE_EDGES, sizeof(RefEdge));
+			return edge;
 		} else {
 			RefEdge* edge = buffer;
 			buffer = edge->source;
@@ -149,6 +187,54 @@ public:
 		return edge_count >= edge_capacity;
 	}
 
+	// Count an edge which was not created for lack of room
+	void discard() {
+		max_cleaned_edges = max(max_cleaned_edges, ++cleaned_edges);
+	}
+
+	int capacity() {
+		return edge_capacity;
+	}
+
+	// Are the edges kept in a temporary file?
+	bool file_backed() {
+		return arena.size() > 0;
+	}
+
+	// Largest number of edges alive at once during the current or last pass
+	int pass_edges() {
+		return pass_max_edges;
+	}
+
+	// Number of edges discarded during the current or last pass
+	int pass_cleaned_edges() {
+		return cleaned_edges;
+	}
+
+	// Let the capacity grow up to the given number of edges, 0 for fixed
+	void set_growth_limit(int limit) {
+		growth_limit = limit;
+	}
+
+	int get_growth_limit() {
+		return growth_limit;
+	}
+
+	// Take over the capacity reached by an earlier run on the same inputs
+	void restore_capacity(int capacity) {
+		edge_capacity = capacity;
+	}
+
+	// Called after a pass. If edges were discarded during the pass, double
+	// the capacity, up to the growth limit. Edges beyond the arena, if any,
+	// are allocated individually. Returns whether the capacity grew.
+	bool grow() {
+		if (cleaned_edges == 0 || edge_capacity >= growth_limit) return false;
+		edge_capacity = (int) min((long long) edge_capacity * 2, (long long) growth_limit);
+		resizes.push_back(edge_capacity);
+		return true;
+	}
+
 };
 
 class LZProgress {
@@ -166,6 +252,7 @@ struct LZResultEdge {
 	int length;
 
 	LZResultEdge(RefEdge *edge) : pos(edge->pos), offset(edge->offset), length(edge->length) {}
+	LZResultEdge(int pos, int offset, int length) : pos(pos), offset(offset), length(length) {}
 
 	friend class LZParseResult;
 };
@@ -207,6 +294,9 @@ public:
 	}
 
 	friend class LZParser;
+	friend class GreedyParser;
+	friend class BeamParser;
+	friend class ResultCache;
 };
 
 class LZParser {
@@ -219,8 +309,8 @@ class LZParser {
 	const LZEncoder* encoderp;
 	RefEdgeFactory* edge_factory;
 
-	vector<int> literal_size;
-	vector<CuckooHash<RefEdge*> > edges_to_pos;
+	vector<long long> literal_size;
+	vector<CuckooHash<RefEdge*>, TrackedAllocator<CuckooHash<RefEdge*>, MEMORY_EDGES_TO_POS> > edges_to_pos;
 	RefEdge* best;
 	CuckooHash<RefEdge*> best_for_offset;
 	Heap<RefEdge*> root_edges;
@@ -234,16 +324,21 @@ class LZParser {
 	}
 
 	void releaseEdge(RefEdge *edge, bool clean = false) {
+		int chain = 0;
 		while (edge != NULL) {
 			RefEdge *source = edge->source;
 			if (--edge->refcount == 0) {
 				assert(!is_root(edge));
 				edge_factory->destroy(edge, clean);
+				chain++;
 			} else {
-				return;
+				break;
 			}
 			edge = source;
 		}
+		Counters::add(COUNTER_EDGE_RELEASES);
+		Counters::add(COUNTER_RELEASE_CHAIN_TOTAL, chain);
+		Counters::maximum(COUNTER_RELEASE_CHAIN_MAX, chain);
 	}
 
 	// Return progress
@@ -255,6 +350,7 @@ class LZParser {
 			? edges_to_pos[worst_edge->target()]
 			: best_for_offset;
 		if (container.size() > 1 && container.count(worst_edge->offset) > 0) {
+			Counters::add(COUNTER_EDGES_CLEANED);
 			container.erase(worst_edge->offset);
 			releaseEdge(worst_edge, true);
 		}
@@ -267,12 +363,14 @@ class LZParser {
 			by_offset[edge->offset] = edge;
 			root_edges.insert(edge);
 		} else if (edge->total_size < by_offset[edge->offset]->total_size) {
+			Counters::add(COUNTER_EDGES_REPLACED);
 			RefEdge* old_edge = by_offset[edge->offset];
 			remove_root(old_edge);
 			releaseEdge(old_edge);
 			by_offset[edge->offset] = edge;
 			root_edges.insert(edge);
 		} else {
+			Counters::add(COUNTER_EDGES_REJECTED);
 			releaseEdge(edge);
 		}
 	}
@@ -284,13 +382,14 @@ class LZParser {
 		LZState state_before;
 		LZState state_after;
 		encoderp->constructState(&state_before, pos, pos == prev_target, source ? source->offset : 0);
-		int size_before = (source ? source->total_size : literal_size[data_length]) - (literal_size[data_length] - literal_size[pos]);
+		long long size_before = (source ? source->total_size : literal_size[data_length]) - (literal_size[data_length] - literal_size[pos]);
 		int edge_size = encoderp->encodeReference(offset, length, &state_before, &state_after);
-		int size_after = literal_size[data_length] - literal_size[new_target];
+		long long size_after = literal_size[data_length] - literal_size[new_target];
 		while (edge_factory->full()) {
 			if (!clean_worst_edge(pos, source)) break;
 		}
 		RefEdge *new_edge = edge_factory->create(pos, offset, length, size_before + edge_size + size_after, source);
+		Counters::add(COUNTER_EDGES_CREATED);
 		put_by_offset(edges_to_pos[new_target], new_edge);
 	}
 
@@ -314,7 +413,7 @@ public:
 
 		// Accumulate literal sizes
 		literal_size.resize(data_length + 1, 0);
-		int size = 0;
+		long long size = 0;
 		LZState literal_state;
 		encoder.setInitialState(&literal_state);
 		for (int i = 0 ; i < data_length ; i++) {
@@ -0,0 +1,112 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Read-only access to the contents of a file.
+
+Where available, the file is mapped into memory, so that its contents are
+read on demand by the operating system and never copied. On other
+platforms, the file is read into a buffer of exactly the file size.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <climits>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(AMIGA)
+#define MMAP_SUPPORTED
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using std::vector;
+
+class MappedFile {
+	const unsigned char *bytes;
+	int length;
+	bool oversized;
+#ifdef MMAP_SUPPORTED
+	void *address;
+#else
+	vector<unsigned char> buffer;
+#endif
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+public:
+	MappedFile() : bytes(NULL), length(0), oversized(false) {
+#ifdef MMAP_SUPPORTED
+		address = NULL;
+#endif
+	}
+
+	~MappedFile() {
+#ifdef MMAP_SUPPORTED
+		if (address) munmap(address, length);
+#endif
+	}
+
+	// Returns false if the file could not be read or is too big
+	bool open(const char *filename) {
+#ifdef MMAP_SUPPORTED
+		int fd = ::open(filename, O_RDONLY);
+		if (fd < 0) return false;
+		struct stat info;
+		if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size > INT_MAX) {
+			oversized = fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > INT_MAX;
+			close(fd);
+			return false;
+		}
+		length = info.st_size;
+		if (length > 0) {
+			address = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address == MAP_FAILED) {
+				address = NULL;
+				length = 0;
+				close(fd);
+				return false;
+			}
+			bytes = (const unsigned char *) address;
+		}
+		close(fd);
+		return true;
+#else
+		FILE *file = fopen(filename, "rb");
+		if (!file) return false;
+		fseek(file, 0, SEEK_END);
+		long size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+		if (size < 0 || size > INT_MAX) {
+			oversized = true;
+			fclose(file);
+			return false;
+		}
+		buffer.resize(size);
+		bool ok = size == 0 || fread(&buffer[0], 1, size, file) == size;
+		fclose(file);
+		if (!ok) return false;
+		length = size;
+		bytes = length > 0 ? &buffer[0] : NULL;
+		return true;
+#endif
+	}
+
+	// Did opening fail because the file is larger than INT_MAX bytes?
+	bool too_large() {
+		return oversized;
+	}
+
+	const unsigned char *data() {
+		return bytes;
+	}
+
+	int size() {
+		return length;
+	}
+};
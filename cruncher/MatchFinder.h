@@ -16,6 +16,12 @@ before the matcher gives up finding more matches.
 The max_same_length parameter controls how many matches of the same length
 are reported. The matches reported will be the closest ones of that length.
 
+If max_offset is given, only matches at most that far back are reported.
+
+For inputs too big to keep the suffix array and its companions in memory,
+the arrays can be kept in temporary files and accessed through mappings.
+
+
 */
 
 #pragma once
@@ -28,19 +34,23 @@ are reported. The matches reported will be the closest ones of that length.
 using std::vector;
 
 #include "SuffixArray.h"
+#include "FileBackedArray.h"
+#include "Counters.h"
 
 class MatchFinder {
 	// Inputs
-	unsigned char *data;
+	const unsigned char *data;
 	int length;
 	int min_length;
 	int match_patience;
 	int max_same_length;
+	int max_offset;
 
 	// Suffix array
-	vector<int> suffix_array;
-	vector<int> rev_suffix_array;
-	vector<int> longest_common_prefix;
+	FileBackedArray<int, MEMORY_SUFFIX_ARRAY> suffix_array;
+	FileBackedArray<int, MEMORY_SUFFIX_ARRAY> rev_suffix_array;
+	FileBackedArray<int, MEMORY_SUFFIX_ARRAY> longest_common_prefix;
+	bool file_backed;
 
 	// Matcher parameters
 	int current_pos;
@@ -58,15 +68,16 @@ class MatchFinder {
 
 	void make_suffix_array() {
 		// Use reverse suffix array to store string as integers with sentinel
-		rev_suffix_array.resize(length + 1);
+		rev_suffix_array.allocate(length + 1, file_backed);
 		for (int i = 0; i < length ; i++) {
 			rev_suffix_array[i] = data[i] + 1;
 		}
 		rev_suffix_array[length] = 0;
 
-		// Compute suffix array
-		suffix_array.resize(length + 1);
-		computeSuffixArray(&rev_suffix_array[0], &suffix_array[0], length + 1, 257);
+		// Compute suffix array, using the LCP array as scratch space
+		suffix_array.allocate(length + 1, file_backed);
+		longest_common_prefix.allocate(scratch_length(length), file_backed);
+		computeSuffixArray(rev_suffix_array.data(), suffix_array.data(), length + 1, 257, longest_common_prefix.data());
 
 		// Compute reverse suffix array
 		for (int i = 0 ; i <= length ; i++) {
@@ -74,7 +85,6 @@ class MatchFinder {
 		}
 
 		// Compute LCP array
-		longest_common_prefix.resize(length + 1);
 		longest_common_prefix[0] = 0;
 		longest_common_prefix[length] = 0;
 		int h = 0;
@@ -99,6 +109,7 @@ class MatchFinder {
 			int pos = suffix_array[left_index];
 			if (pos < current_pos && pos >= min_pos) break;
 			if (++iter > match_patience) {
+				Counters::add(COUNTER_LEFT_PATIENCE_EXHAUSTED);
 				left_length = 0;
 				break;
 			}
@@ -113,30 +124,45 @@ class MatchFinder {
 			int pos = suffix_array[++right_index];
 			if (pos < current_pos && pos >= min_pos) break;
 			if (++iter > match_patience) {
+				Counters::add(COUNTER_RIGHT_PATIENCE_EXHAUSTED);
 				right_length = 0;
 				break;
 			}
 		}
 	}
 
+	// Length of the LCP array, which is also the suffix array construction scratch space
+	static int scratch_length(int length) {
+		return std::max(length + 1, 2 * 257 + 1);
+	}
+
 	int next_length() {
 		return std::max(left_length, right_length);
 	}
 
 public:
-	MatchFinder(unsigned char *data, int length, int min_length, int match_patience, int max_same_length) :
-		data(data), length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length) {
+	MatchFinder(const unsigned char *data, int length, int min_length, int match_patience, int max_same_length, int max_offset = 0, bool file_backed = false) :
+		data(data), length(length), min_length(min_length), match_patience(match_patience), max_same_length(max_same_length), max_offset(max_offset), file_backed(file_backed) {
 		make_suffix_array();
 		reset();
 	}
 
+	// Bytes needed for the arrays of a match finder for data of the given length
+	static long long memory_needed(int length) {
+		return (2 * ((long long) length + 1) + scratch_length(length)) * sizeof(int);
+	}
+
 	void reset() {
 	}
 
 	// Start finding matches between strings starting at pos and earlier strings.
 	void beginMatching(int pos) {
 		current_pos = pos;
-		min_pos = 0;
+		min_pos = max_offset ? std::max(pos - max_offset, 0) : 0;
+		while (!match_buffer.empty()) {
+			// Matches not consumed from previous position
+			match_buffer.pop();
+		}
 
 		left_index = rev_suffix_array[pos];
 		left_length = length - pos;
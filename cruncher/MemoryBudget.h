@@ -0,0 +1,134 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Estimation of the memory needed for crunching, used to fit the crunching
+data structures within a memory budget.
+
+The memory needed for a block of data consists of the match finder
+arrays (which double as scratch space for building the suffix array), the
+suffix type bits, the per-position state of the parser, the number size
+caches of the coders, the parse results, and the reference edges. All but
+the edges are proportional to the length of the block. The edges are bounded
+by the size of the reference buffer.
+
+Given a budget, the match finder arrays and the reference edges are kept
+in temporary files if they do not fit in memory, and the reference
+buffer is made as large as the remaining memory allows.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <utility>
+
+#if !defined(_WIN32) && !defined(AMIGA)
+#define RESOURCE_USAGE_SUPPORTED
+#include <sys/resource.h>
+#endif
+
+using std::pair;
+
+#include "PackParams.h"
+#include "MatchFinder.h"
+#include "CuckooHash.h"
+#include "LZParser.h"
+
+class MemoryBudget {
+	static const int MAX_REFERENCES = 100000000;
+
+	// Bytes per byte of data, apart from the match finder arrays
+	static long long per_byte(const PackParams *params) {
+		long long bytes = 1;                                         // Input data
+		bytes += 2 * LZEncoder::NUM_NUMBER_CONTEXTS;                 // Number size caches
+		bytes += sizeof(long long);                                  // Literal size prefix sums
+		bytes += sizeof(LZResultEdge);                               // Two parse results of up to one symbol per two bytes
+		bytes += 2;                                                  // Crunched output
+		if (params->beam_width > 0) {
+			bytes += params->beam_width * sizeof(RefEdge*) + sizeof(int); // Beam slots
+		} else {
+			bytes += sizeof(CuckooHash<RefEdge*>);                   // Edges ending at each position
+		}
+		return bytes;
+	}
+
+public:
+	// Budget in bytes
+	static long long budget(const PackParams *params) {
+		return (long long) params->max_memory << 20;
+	}
+
+	// Bytes used per reference edge, including its place in the parser structures
+	static long long edge_bytes() {
+		return sizeof(RefEdge) + 16 + sizeof(RefEdge*) + 2 * sizeof(pair<int, RefEdge*>);
+	}
+
+	// Bytes needed for crunching a block of the given length, not counting
+	// the reference edges or the match finder arrays. The suffix type bits
+	// of all suffix array recursion levels add up to a quarter byte per byte.
+	static long long block_bytes(const PackParams *params, int length) {
+		return per_byte(params) * length + length / 4 + (1 << 20);
+	}
+
+	// Should the match finder arrays go to temporary files to keep within the budget?
+	static bool file_backed_matcher(const PackParams *params, int length, int references, bool edge_file) {
+		if (!params->max_memory) return false;
+		long long edges = edge_file ? 0 : references * edge_bytes();
+		return block_bytes(params, length) + edges + MatchFinder::memory_needed(length) > budget(params);
+	}
+
+	// Predicted peak memory for crunching a block of the given length
+	static long long predicted(const PackParams *params, int length, int references, bool edge_file) {
+		long long bytes = block_bytes(params, length);
+		if (!edge_file) bytes += references * edge_bytes();
+		if (!file_backed_matcher(params, length, references, edge_file)) {
+			bytes += MatchFinder::memory_needed(length);
+		}
+		return bytes;
+	}
+
+	// Choose the size of the reference buffer for crunching a block of the
+	// given length within the budget. Memory left over after the match
+	// finder arrays goes to the reference buffer, if that makes it larger
+	// than the given size and no size was requested. If the buffer does
+	// not fit, its edges are kept in a temporary file, and if the match
+	// finder arrays still do not fit, they are too.
+	static int fit_references(const PackParams *params, int length, int references, bool requested, bool *edge_file) {
+		long long available = budget(params) - block_bytes(params, length) - MatchFinder::memory_needed(length);
+		if (!requested && !*edge_file && available / edge_bytes() > references) {
+			return (int) std::min(available / edge_bytes(), (long long) MAX_REFERENCES);
+		}
+		if (references * edge_bytes() > available) {
+			*edge_file = true;
+		}
+		return references;
+	}
+
+	// Largest size to grow the reference buffer to, given a ceiling in
+	// megabytes for the edges. Under a budget, edges kept in memory must
+	// also fit alongside everything else.
+	static int growth_limit(const PackParams *params, int length, int ceiling, bool edge_file) {
+		long long limit = ((long long) ceiling << 20) / edge_bytes();
+		if (params->max_memory && !edge_file) {
+			long long available = budget(params) - block_bytes(params, length) - MatchFinder::memory_needed(length);
+			limit = std::min(limit, available / edge_bytes());
+		}
+		return (int) std::max(std::min(limit, (long long) MAX_REFERENCES), 0LL);
+	}
+
+	// Peak memory used by the process so far, or 0 if unknown
+	static long long peak_usage() {
+#ifdef RESOURCE_USAGE_SUPPORTED
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+		return usage.ru_maxrss;
+#else
+		return (long long) usage.ru_maxrss << 10;
+#endif
+#else
+		return 0;
+#endif
+	}
+};
@@ -0,0 +1,160 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Accounting of the memory used by the main data structures of the cruncher.
+
+Each subsystem keeps track of the bytes it currently has allocated, and
+the peak since the last reset. Vectors are tracked through an allocator
+which reports to the subsystem given as a template argument. Other
+structures report their allocations explicitly.
+
+The accounting covers the whole process, so when several hunks or blocks
+are crunched in parallel, their use is added up. Data kept in temporary
+files is not counted.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstddef>
+#include <new>
+
+#ifndef AMIGA
+#include <atomic>
+#endif
+
+enum MemorySubsystem {
+	MEMORY_SUFFIX_ARRAY,
+	MEMORY_EDGES_TO_POS,
+	MEMORY_CUCKOO_HASH,
+	MEMORY_REFERENCE_EDGES,
+	MEMORY_CODER_CACHES,
+	MEMORY_OUTPUT,
+	NUM_MEMORY_SUBSYSTEMS
+};
+
+struct MemoryUse {
+	long long current[NUM_MEMORY_SUBSYSTEMS];
+	long long peak[NUM_MEMORY_SUBSYSTEMS];
+};
+
+class MemoryTracker {
+#ifndef AMIGA
+	typedef std::atomic<long long> Count;
+#else
+	typedef long long Count;
+#endif
+
+	struct Counts {
+		Count current[NUM_MEMORY_SUBSYSTEMS];
+		Count peak[NUM_MEMORY_SUBSYSTEMS];
+
+		Counts() {
+			for (int s = 0 ; s < NUM_MEMORY_SUBSYSTEMS ; s++) {
+				current[s] = 0;
+				peak[s] = 0;
+			}
+		}
+	};
+
+	static Counts& counts() {
+		static Counts counts;
+		return counts;
+	}
+
+public:
+	static const char* name(int subsystem) {
+		static const char *names[NUM_MEMORY_SUBSYSTEMS] = {
+			"Suffix array",
+			"Edges to position",
+			"Cuckoo hash arrays",
+			"Reference edges",
+			"Coder caches",
+			"Output buffers",
+		};
+		return names[subsystem];
+	}
+
+	static void allocated(MemorySubsystem subsystem, long long bytes) {
+		Counts& c = counts();
+		long long now = (c.current[subsystem] += bytes);
+		long long peak = c.peak[subsystem];
+#ifndef AMIGA
+		while (now > peak && !c.peak[subsystem].compare_exchange_weak(peak, now));
+#else
+		if (now > peak) c.peak[subsystem] = now;
+#endif
+	}
+
+	static void freed(MemorySubsystem subsystem, long long bytes) {
+		counts().current[subsystem] -= bytes;
+	}
+
+	// Start measuring peaks from the current use
+	static void reset_peaks() {
+		Counts& c = counts();
+		for (int s = 0 ; s < NUM_MEMORY_SUBSYSTEMS ; s++) {
+			c.peak[s] = (long long) c.current[s];
+		}
+	}
+
+	static MemoryUse use() {
+		Counts& c = counts();
+		MemoryUse use;
+		for (int s = 0 ; s < NUM_MEMORY_SUBSYSTEMS ; s++) {
+			use.current[s] = c.current[s];
+			use.peak[s] = c.peak[s];
+		}
+		return use;
+	}
+
+	static void print(FILE *out) {
+		if (!out) return;
+		MemoryUse u = use();
+		fprintf(out, "Process memory per subsystem: current          peak\n");
+		for (int s = 0 ; s < NUM_MEMORY_SUBSYSTEMS ; s++) {
+			fprintf(out, "  %-20s%12.1f MB%11.1f MB\n", name(s), u.current[s] / 1048576.0, u.peak[s] / 1048576.0);
+		}
+		fprintf(out, "\n");
+	}
+};
+
+// Allocator which accounts its allocations to the given subsystem
+template <class T, MemorySubsystem S>
+class TrackedAllocator {
+public:
+	typedef T value_type;
+
+	template <class U>
+	struct rebind {
+		typedef TrackedAllocator<U, S> other;
+	};
+
+	TrackedAllocator() {}
+
+	template <class U>
+	TrackedAllocator(const TrackedAllocator<U, S>& other) {}
+
+	T* allocate(size_t n) {
+		T *p = static_cast<T*>(::operator new(n * sizeof(T)));
+		MemoryTracker::allocated(S, n * sizeof(T));
+		return p;
+	}
+
+	void deallocate(T *p, size_t n) {
+		MemoryTracker::freed(S, n * sizeof(T));
+		::operator delete(p);
+	}
+
+	template <class U>
+	bool operator==(const TrackedAllocator<U, S>& other) const {
+		return true;
+	}
+
+	template <class U>
+	bool operator!=(const TrackedAllocator<U, S>& other) const {
+		return false;
+	}
+};
@@ -0,0 +1,145 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Symbol statistics carried over between compressions.
+
+The final (blended) counts of each packed block can be recorded and saved
+to a text file. A later compression of a similar file can load them and
+use them as the cost model for its first pass, instead of starting from a
+flat model. The counts are keyed by block (hunk) index and hunk type.
+
+Optionally, a block without loaded statistics can instead be seeded from
+the final counts of the previous block of the same type in the same run.
+These counts are scaled down according to the relative sizes of the two
+blocks, so that they act as a prior which is quickly overridden by the
+actual statistics of the block.
+
+The file format is a header line followed by one section per block:
+
+  <hunk index> <hunk type> <number of contexts>
+  <count of zeros> <count of ones>     (one line per context)
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+#include <algorithm>
+
+using std::map;
+using std::min;
+using std::make_pair;
+using std::pair;
+
+#include "Status.h"
+#include "CountingCoder.h"
+#include "assert.h"
+
+#define STATISTICS_FILE_HEADER "Shrinkler model statistics, version 1"
+
+class ModelStatistics {
+	typedef pair<int, unsigned> key_type;
+
+	// Weight of previous block relative to a block of the same size
+	static constexpr double PRIOR_WEIGHT = 0.5;
+
+	// Most contexts accepted for a block in a statistics file
+	static const int MAX_CONTEXTS = 65536;
+
+	map<key_type, vector<ContextCounts> > loaded;
+	map<key_type, vector<ContextCounts> > recorded;
+
+	// Final counts and length of the previous block of each type
+	bool cross_block;
+	map<unsigned, pair<vector<ContextCounts>, int> > previous;
+
+public:
+	ModelStatistics(bool cross_block) : cross_block(cross_block) {}
+
+	// Returns false if the file could not be opened
+	bool load(const char *filename) {
+		FILE *file;
+		if (!(file = fopen(filename, "r"))) {
+			return false;
+		}
+		char line[100];
+		bool ok = fgets(line, sizeof(line), file) && strncmp(line, STATISTICS_FILE_HEADER, strlen(STATISTICS_FILE_HEADER)) == 0;
+		int hunk;
+		unsigned type;
+		int n_contexts;
+		while (ok && fscanf(file, "%d %u %d", &hunk, &type, &n_contexts) == 3) {
+			if (n_contexts < 0 || n_contexts > MAX_CONTEXTS) {
+				ok = false;
+				break;
+			}
+			vector<ContextCounts>& counts = loaded[make_pair(hunk, type)];
+			counts.resize(n_contexts);
+			for (int i = 0 ; i < n_contexts ; i++) {
+				if (fscanf(file, "%d %d", &counts[i].counts[0], &counts[i].counts[1]) != 2 ||
+				    counts[i].counts[0] < 0 || counts[i].counts[1] < 0) {
+					ok = false;
+					break;
+				}
+			}
+		}
+		if (!ok || !feof(file)) {
+			status("Error while reading statistics file %s\n\n", filename);
+			fatal_error();
+		}
+		fclose(file);
+		return true;
+	}
+
+	void save(const char *filename) {
+		FILE *file;
+		if ((file = fopen(filename, "w"))) {
+			fprintf(file, "%s\n", STATISTICS_FILE_HEADER);
+			for (map<key_type, vector<ContextCounts> >::iterator it = recorded.begin() ; it != recorded.end() ; it++) {
+				vector<ContextCounts>& counts = it->second;
+				fprintf(file, "%d %u %d\n", it->first.first, it->first.second, (int) counts.size());
+				for (int i = 0 ; i < counts.size() ; i++) {
+					fprintf(file, "%d %d\n", counts[i].counts[0], counts[i].counts[1]);
+				}
+			}
+			if (fclose(file) == 0) {
+				return;
+			}
+		}
+
+		status("Error while writing statistics file %s\n\n", filename);
+		fatal_error();
+	}
+
+	// Initialize counts for a block. Returns whether any statistics were found.
+	bool seed(int hunk, unsigned type, int length, CountingCoder *counts) {
+		map<key_type, vector<ContextCounts> >::iterator it = loaded.find(make_pair(hunk, type));
+		if (it != loaded.end() && it->second.size() == counts->context_counts.size()) {
+			counts->context_counts = it->second;
+			return true;
+		}
+		if (cross_block && previous.count(type) > 0 && length > 0) {
+			vector<ContextCounts>& prev_counts = previous[type].first;
+			int prev_length = previous[type].second;
+			double scale = PRIOR_WEIGHT * min(1.0, length / (double) prev_length);
+			for (int i = 0 ; i < prev_counts.size() ; i++) {
+				counts->context_counts[i].counts[0] = (int) (prev_counts[i].counts[0] * scale);
+				counts->context_counts[i].counts[1] = (int) (prev_counts[i].counts[1] * scale);
+			}
+			return true;
+		}
+		return false;
+	}
+
+	// Record final counts for a block
+	void record(int hunk, unsigned type, int length, CountingCoder *counts) {
+		recorded[make_pair(hunk, type)] = counts->context_counts;
+		if (length > 0) {
+			previous[type] = make_pair(counts->context_counts, length);
+		}
+	}
+};
@@ -8,22 +8,20 @@ Pack a data block in multiple iterations, reporting progress along the way.
 
 #pragma once
 
+#include "Status.h"
+#include "PackParams.h"
 #include "RangeCoder.h"
 #include "MatchFinder.h"
 #include "CountingCoder.h"
+#include "ModelStatistics.h"
 #include "SizeMeasuringCoder.h"
 #include "LZEncoder.h"
 #include "LZParser.h"
-
-struct PackParams {
-	bool parity_context;
-
-	int iterations;
-	int length_margin;
-	int skip_length;
-	int match_patience;
-	int max_same_length;
-};
+#include "GreedyParser.h"
+#include "BeamParser.h"
+#include "MemoryBudget.h"
+#include "Report.h"
+#include "Trace.h"
 
 class PackProgress : public LZProgress {
 	int size;
@@ -32,12 +30,12 @@ class PackProgress : public LZProgress {
 	int textlength;
 
 	void print() {
-		textlength = printf("[%d.%d%%]", steps / 10, steps % 10);
-		fflush(stdout);
+		textlength = status("[%d.%d%%]", steps / 10, steps % 10);
+		status_flush();
 	}
 
 	void rewind() {
-		printf("\033[%dD", textlength);
+		status("\033[%dD", textlength);
 	}
 public:
 	virtual void begin(int size) {
@@ -59,15 +57,15 @@ public:
 
 	virtual void end() {
 		rewind();
-		printf("\033[K");
-		fflush(stdout);
+		status("\033[K");
+		status_flush();
 	}
 };
 
 class NoProgress : public LZProgress {
 public:
 	virtual void begin(int size) {
-		fflush(stdout);
+		status_flush();
 	}
 
 	virtual void update(int pos) {
@@ -77,38 +75,80 @@ public:
 	}
 };
 
-void packData(unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, bool show_progress) {
-	MatchFinder finder(data, data_length, 2, params->match_patience, params->max_same_length);
-	LZParser parser(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, edge_factory);
+// Pack a block and encode the best result into the result coder.
+// Returns the best parse result.
+// If initial_counts is given, it provides the cost model for the first pass.
+// If final_counts is given, it receives the statistics after the last pass.
+LZParseResult packData(const unsigned char *data, int data_length, int zero_padding, PackParams *params, Coder *result_coder, RefEdgeFactory *edge_factory, LZProgress *progress,
+              CountingCoder *initial_counts = NULL, CountingCoder *final_counts = NULL) {
+	TraceSpan pack_span("pack");
+	// Keep the match finder arrays in temporary files if they do not fit the memory budget
+	bool file_backed = MemoryBudget::file_backed_matcher(params, data_length, edge_factory->capacity(), edge_factory->file_backed());
+	BlockReport *block_report = report_block();
+	Stopwatch stopwatch;
+	TraceSpan suffix_array_span("suffix_array");
+	MatchFinder finder(data, data_length, 2, params->match_patience, params->max_same_length, params->max_offset, file_backed);
+	suffix_array_span.end();
+	if (block_report) {
+		block_report->suffix_array = stopwatch.elapsed();
+	}
+	LZParser *parser = NULL;
+	BeamParser *beam_parser = NULL;
+	if (params->beam_width > 0) {
+		beam_parser = new BeamParser(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, params->beam_width, edge_factory);
+	} else {
+		parser = new LZParser(data, data_length, zero_padding, finder, params->length_margin, params->skip_length, edge_factory);
+	}
+	GreedyParser greedy_parser(data, data_length, zero_padding, finder);
 	result_size_t real_size = 0;
 	result_size_t best_size = (result_size_t)1 << (32 + 3 + Coder::BIT_PRECISION);
 	int best_result = 0;
 	vector<LZParseResult> results(2);
-	CountingCoder *counting_coder = new CountingCoder(LZEncoder::NUM_CONTEXTS);
-	LZProgress *progress;
-	if (show_progress) {
-		progress = new PackProgress();
-	} else {
-		progress = new NoProgress();
-	}
-	printf("%8d", data_length);
+	CountingCoder *counting_coder = initial_counts
+		? new CountingCoder(*initial_counts)
+		: new CountingCoder(LZEncoder::NUM_CONTEXTS);
+	status("%8d", data_length);
 	for (int i = 0 ; i < params->iterations ; i++) {
-		printf("  ");
+		status("  ");
+		PassReport pass;
+		stopwatch.restart();
+		TraceSpan pass_span("pass", "pass", i + 1);
 
 		// Parse data into LZ symbols
+		TraceSpan parse_span("parse");
 		LZParseResult& result = results[1 - best_result];
-		Coder *measurer = new SizeMeasuringCoder(counting_coder);
-		measurer->setNumberContexts(LZEncoder::NUMBER_CONTEXT_OFFSET, LZEncoder::NUM_NUMBER_CONTEXTS, data_length);
 		finder.reset();
-		result = parser.parse(LZEncoder(measurer, params->parity_context), progress);
-		delete measurer;
+		if (i == 0 && params->greedy_first_pass && !initial_counts) {
+			// No statistics yet, so a cheap parse is as good a start as any
+			result = greedy_parser.parse(progress);
+		} else {
+			Coder *measurer = new SizeMeasuringCoder(counting_coder);
+			measurer->setNumberContexts(LZEncoder::NUMBER_CONTEXT_OFFSET, LZEncoder::NUM_NUMBER_CONTEXTS, data_length);
+			LZEncoder measuring_encoder(measurer, params->parity_context);
+			if (beam_parser) {
+				result = beam_parser->parse(measuring_encoder, progress);
+			} else {
+				result = parser->parse(measuring_encoder, progress);
+
+				// Give later passes more room if this one ran out of references
+				edge_factory->grow();
+			}
+			delete measurer;
+			pass.references = edge_factory->pass_edges();
+			pass.discarded = edge_factory->pass_cleaned_edges();
+		}
+		pass.parse = stopwatch.lap();
+		parse_span.end();
 
 		// Encode result using adaptive range coding
+		TraceSpan measure_span("measure");
 		vector<unsigned char> dummy_result;
 		RangeCoder *range_coder = new RangeCoder(LZEncoder::NUM_CONTEXTS, dummy_result);
 		real_size = result.encode(LZEncoder(range_coder, params->parity_context));
 		range_coder->finish();
 		delete range_coder;
+		pass.measure = stopwatch.lap();
+		measure_span.end();
 
 		// Choose if best
 		if (real_size < best_size) {
@@ -117,9 +157,10 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		}
 
 		// Print size
-		printf("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
+		status("%14.3f", real_size / (double) (8 << Coder::BIT_PRECISION));
 
 		// Count symbol frequencies
+		TraceSpan count_span("count");
 		CountingCoder *new_counting_coder = new CountingCoder(LZEncoder::NUM_CONTEXTS);
 		result.encode(LZEncoder(counting_coder, params->parity_context));
 	
@@ -128,9 +169,27 @@ void packData(unsigned char *data, int data_length, int zero_padding, PackParams
 		counting_coder = new CountingCoder(old_counting_coder, new_counting_coder);
 		delete old_counting_coder;
 		delete new_counting_coder;
+		count_span.end();
+
+		if (block_report) {
+			pass.count = stopwatch.lap();
+			pass.size = real_size / (double) (8 << Coder::BIT_PRECISION);
+			pass.capacity = edge_factory->capacity();
+			block_report->passes.push_back(pass);
+		}
+	}
+	if (final_counts) {
+		*final_counts = *counting_coder;
+	}
+	if (block_report) {
+		block_report->has_memory = true;
+		block_report->memory = MemoryTracker::use();
 	}
-	delete progress;
 	delete counting_coder;
+	delete parser;
+	delete beam_parser;
 
+	TraceSpan encode_span("encode");
 	results[best_result].encode(LZEncoder(result_coder, params->parity_context));
+	return results[best_result];
 }
@@ -0,0 +1,23 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Parameters controlling the compression of a data block.
+
+*/
+
+#pragma once
+
+struct PackParams {
+	bool parity_context;
+	bool greedy_first_pass;
+	int beam_width; // 0 for local optimal parse
+
+	int iterations;
+	int length_margin;
+	int skip_length;
+	int match_patience;
+	int max_same_length;
+	int max_offset; // 0 for unlimited
+	int max_memory; // Megabytes, or 0 for unlimited
+};
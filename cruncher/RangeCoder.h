@@ -17,6 +17,8 @@ using std::fill;
 using std::vector;
 
 #include "Coder.h"
+#include "Counters.h"
+#include "MemoryTracker.h"
 
 #ifndef ADJUST_SHIFT
 #define ADJUST_SHIFT 4
@@ -25,50 +27,79 @@ using std::vector;
 class RangeCoder : public Coder {
 	vector<unsigned short> contexts;
 	vector<unsigned char>& out;
-	int dest_bit;
+	long long dest_bit;
 	unsigned intervalsize;
 	unsigned intervalmin;
+	long long tracked_output;
 
-	static int sizetable[128];
-	static bool sizetable_init;
+	// Size in bits (fixed point) of the remaining interval
+	struct SizeTable {
+		int size[128];
 
-	static bool init_sizetable() {
-		for (int i = 0 ; i < 128 ; i++) {
-			sizetable[i] = (int) floor(0.5 + (8.0 - log((double) (128 + i)) / log(2.0)) * (1 << BIT_PRECISION));
+		SizeTable() {
+			for (int i = 0 ; i < 128 ; i++) {
+				size[i] = (int) floor(0.5 + (8.0 - log((double) (128 + i)) / log(2.0)) * (1 << BIT_PRECISION));
+			}
 		}
+	};
+
+	// Initialized on first use, which is thread safe
+	static const int* get_sizetable() {
+		static const SizeTable table;
+		return table.size;
+	}
+
+	const int *sizetable;
 
-		return true;
+	// Account for the output buffer while it is being written
+	void track_output() {
+		long long bytes = out.capacity();
+		MemoryTracker::allocated(MEMORY_OUTPUT, bytes - tracked_output);
+		tracked_output = bytes;
 	}
 
 	void addBit() {
-		int pos = dest_bit;
-		int bytepos;
+		Counters::add(COUNTER_RANGE_CARRIES);
+		long long pos = dest_bit;
+		size_t bytepos;
 		int bitmask;
 		do {
+			Counters::add(COUNTER_RANGE_CARRY_STEPS);
 			pos--;
 			if (pos < 0) return;
 			bytepos = pos >> 3;
 			bitmask = 0x80 >> (pos & 7);
 			while (bytepos >= out.size()) {
 				out.push_back(0);
+				if (out.capacity() != tracked_output) {
+					track_output();
+				}
 			}
 			out[bytepos] ^= bitmask;
 		} while ((out[bytepos] & bitmask) == 0);
 	}
 
 public:
-	RangeCoder(int n_contexts, vector<unsigned char>& out) : out(out) {
+	RangeCoder(int n_contexts, vector<unsigned char>& out) : out(out), sizetable(get_sizetable()) {
 		contexts.resize(n_contexts, 0x8000);
 		dest_bit = -1;
 		intervalsize = 0x8000;
 		intervalmin = 0;
 		out.clear();
+		tracked_output = 0;
+		track_output();
+	}
+
+	~RangeCoder() {
+		MemoryTracker::freed(MEMORY_OUTPUT, tracked_output);
 	}
 
 	virtual int code(int context_index, int bit) {
 		assert(context_index < contexts.size());
 		assert(bit == 0 || bit == 1);
-		int size_before = (dest_bit << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
+		Counters::add(COUNTER_RANGE_CODED_BITS);
+		long long dest_bit_before = dest_bit;
+		int size_before = sizetable[(intervalsize - 0x8000) >> 8];
 		unsigned prob = contexts[context_index];
 		unsigned threshold = (intervalsize * prob) >> 16;
 		unsigned new_prob;
@@ -98,7 +129,8 @@ public:
 		}
 		intervalmin &= 0xffff;
 
-		int size_after = (dest_bit << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
+		// Relative to the output position before, so the size cannot overflow
+		int size_after = ((int) (dest_bit - dest_bit_before) << BIT_PRECISION) + sizetable[(intervalsize - 0x8000) >> 8];
 		return size_after - size_before;
 	}
 
@@ -122,14 +154,11 @@ public:
 		while ((dest_bit - 1) >> 3 >= out.size()) {
 			out.push_back(0);
 		}
+		track_output();
 	}
 
-	int sizeInBits() {
+	long long sizeInBits() {
 		return dest_bit + 1;
 	}
 
 };
-
-
-int RangeCoder::sizetable[128];
-bool RangeCoder::sizetable_init = init_sizetable();
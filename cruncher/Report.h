@@ -0,0 +1,335 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Machine-readable report of a crunching run, written as JSON.
+
+The report records the time spent in each phase of crunching every hunk
+or block - building the suffix array, and for every pass, parsing,
+measuring the size of the result and counting symbol frequencies - along
+with verification times, sizes, reference buffer use and the parameters
+used. Times are given as wall-clock seconds and as CPU seconds of the
+thread doing the work.
+
+After each hunk or block, the memory use per subsystem is recorded along
+with the peak so far. These figures cover the whole process, so when
+blocks are crunched in parallel, they include the other blocks too.
+
+Like the status output, the report being filled in is kept per thread.
+The crunching routines add to the report of the current thread, if any,
+and attribute phase timings to the hunk or block currently in scope.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cctype>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#ifndef AMIGA
+#include <chrono>
+#include <mutex>
+#endif
+
+#include "MemoryTracker.h"
+
+using std::make_pair;
+using std::pair;
+using std::string;
+using std::vector;
+
+// Wall-clock and CPU time of a phase, in seconds
+struct PhaseTime {
+	double wall;
+	double cpu;
+
+	PhaseTime() : wall(0), cpu(0) {}
+
+	void add(const PhaseTime& time) {
+		wall += time.wall;
+		cpu += time.cpu;
+	}
+};
+
+// Measures the wall-clock time and the CPU time of the calling thread,
+// or of the whole process
+class Stopwatch {
+	bool whole_process;
+	double wall_start;
+	double cpu_start;
+
+	static double wall_now() {
+#ifndef AMIGA
+		return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		return clock() / (double) CLOCKS_PER_SEC;
+#endif
+	}
+
+	double cpu_now() {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+		struct timespec ts;
+		if (!whole_process && clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+			return ts.tv_sec + ts.tv_nsec / 1e9;
+		}
+#endif
+		return clock() / (double) CLOCKS_PER_SEC;
+	}
+
+public:
+	Stopwatch(bool whole_process = false) : whole_process(whole_process) {
+		restart();
+	}
+
+	void restart() {
+		wall_start = wall_now();
+		cpu_start = cpu_now();
+	}
+
+	// Time since the stopwatch was started
+	PhaseTime elapsed() {
+		PhaseTime time;
+		time.wall = wall_now() - wall_start;
+		time.cpu = cpu_now() - cpu_start;
+		return time;
+	}
+
+	// Time since the stopwatch was started, restarting it
+	PhaseTime lap() {
+		PhaseTime time = elapsed();
+		restart();
+		return time;
+	}
+};
+
+struct PassReport {
+	PhaseTime parse;
+	PhaseTime measure;
+	PhaseTime count;
+	double size;            // Compressed size in bytes
+	int references;         // Most reference edges alive at once
+	int discarded;          // Reference edges discarded for lack of room
+	int capacity;           // Size of the reference buffer after the pass
+
+	PassReport() : size(0), references(0), discarded(0), capacity(0) {}
+};
+
+struct BlockReport {
+	string kind;
+	int index;
+	int length;
+	bool cached;
+	PhaseTime suffix_array;
+	PhaseTime verify;
+	vector<PassReport> passes;
+	bool has_memory;
+	MemoryUse memory;       // Use of the whole process when the block was done
+
+	BlockReport(const char *kind, int index, int length) : kind(kind), index(index), length(length), cached(false), has_memory(false) {}
+};
+
+class RunReport {
+	vector<pair<string, string> > fields;
+	vector<pair<string, string> > parameters;
+	vector<BlockReport*> blocks;
+#ifndef AMIGA
+	std::mutex lock;
+#endif
+
+	RunReport(const RunReport&);
+	RunReport& operator=(const RunReport&);
+
+	static string quote(const string& s) {
+		string q = "\"";
+		for (int i = 0 ; i < s.size() ; i++) {
+			unsigned char c = s[i];
+			if (c == '"' || c == '\\') {
+				q += '\\';
+				q += c;
+			} else if (c < 0x20) {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				q += escape;
+			} else {
+				q += c;
+			}
+		}
+		return q + "\"";
+	}
+
+	static string number(long long value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%lld", value);
+		return text;
+	}
+
+	static string number(double value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%.6f", value);
+		return text;
+	}
+
+	static string time(const PhaseTime& time) {
+		return "{\"wall\": " + number(time.wall) + ", \"cpu\": " + number(time.cpu) + "}";
+	}
+
+	// Subsystem name as a JSON key
+	static string key(const char *name) {
+		string k;
+		for (int i = 0 ; name[i] ; i++) {
+			k += name[i] == ' ' ? '_' : (char) tolower(name[i]);
+		}
+		return k;
+	}
+
+	static bool block_order(const BlockReport *a, const BlockReport *b) {
+		return a->kind != b->kind ? a->kind < b->kind : a->index < b->index;
+	}
+
+	static void write_fields(FILE *file, const vector<pair<string, string> >& fields, const char *indent) {
+		for (int i = 0 ; i < fields.size() ; i++) {
+			fprintf(file, "%s%s: %s,\n", indent, quote(fields[i].first).c_str(), fields[i].second.c_str());
+		}
+	}
+
+public:
+	RunReport() {}
+
+	~RunReport() {
+		for (int i = 0 ; i < blocks.size() ; i++) {
+			delete blocks[i];
+		}
+	}
+
+	void set(const char *key, const char *value) {
+		fields.push_back(make_pair(string(key), quote(value)));
+	}
+
+	void set(const char *key, long long value) {
+		fields.push_back(make_pair(string(key), number(value)));
+	}
+
+	void set(const char *key, const PhaseTime& value) {
+		fields.push_back(make_pair(string(key), time(value)));
+	}
+
+	void set_parameter(const char *key, int value) {
+		parameters.push_back(make_pair(string(key), number((long long) value)));
+	}
+
+	void set_parameter(const char *key, bool value) {
+		parameters.push_back(make_pair(string(key), string(value ? "true" : "false")));
+	}
+
+	// Start a new block. The report keeps ownership of it.
+	BlockReport* begin_block(const char *kind, int index, int length) {
+		BlockReport *block = new BlockReport(kind, index, length);
+#ifndef AMIGA
+		std::lock_guard<std::mutex> guard(lock);
+#endif
+		blocks.push_back(block);
+		return block;
+	}
+
+	// Find a previously started block, or NULL if there is none
+	BlockReport* find_block(const char *kind, int index) {
+#ifndef AMIGA
+		std::lock_guard<std::mutex> guard(lock);
+#endif
+		for (int i = 0 ; i < blocks.size() ; i++) {
+			if (blocks[i]->kind == kind && blocks[i]->index == index) return blocks[i];
+		}
+		return NULL;
+	}
+
+	bool save(const char *filename) {
+		FILE *file = fopen(filename, "w");
+		if (!file) return false;
+		std::stable_sort(blocks.begin(), blocks.end(), block_order);
+		fprintf(file, "{\n");
+		write_fields(file, fields, "  ");
+		fprintf(file, "  \"parameters\": {");
+		for (int i = 0 ; i < parameters.size() ; i++) {
+			fprintf(file, "%s\n    %s: %s", i ? "," : "", quote(parameters[i].first).c_str(), parameters[i].second.c_str());
+		}
+		fprintf(file, "\n  },\n");
+		fprintf(file, "  \"blocks\": [");
+		for (int b = 0 ; b < blocks.size() ; b++) {
+			const BlockReport& block = *blocks[b];
+			fprintf(file, "%s\n    {\n", b ? "," : "");
+			fprintf(file, "      \"kind\": %s,\n", quote(block.kind).c_str());
+			fprintf(file, "      \"index\": %d,\n", block.index);
+			fprintf(file, "      \"length\": %d,\n", block.length);
+			fprintf(file, "      \"cached\": %s,\n", block.cached ? "true" : "false");
+			fprintf(file, "      \"suffix_array\": %s,\n", time(block.suffix_array).c_str());
+			fprintf(file, "      \"verify\": %s,\n", time(block.verify).c_str());
+			if (block.has_memory) {
+				fprintf(file, "      \"process_memory\": {");
+				for (int s = 0 ; s < NUM_MEMORY_SUBSYSTEMS ; s++) {
+					fprintf(file, "%s\n        %s: {\"current\": %lld, \"peak\": %lld}", s ? "," : "",
+					        quote(key(MemoryTracker::name(s))).c_str(), block.memory.current[s], block.memory.peak[s]);
+				}
+				fprintf(file, "\n      },\n");
+			}
+			fprintf(file, "      \"passes\": [");
+			for (int p = 0 ; p < block.passes.size() ; p++) {
+				const PassReport& pass = block.passes[p];
+				fprintf(file, "%s\n        {\"pass\": %d, \"size\": %.3f, ", p ? "," : "", p + 1, pass.size);
+				fprintf(file, "\"parse\": %s, \"measure\": %s, \"count\": %s, ",
+				        time(pass.parse).c_str(), time(pass.measure).c_str(), time(pass.count).c_str());
+				fprintf(file, "\"references\": %d, \"discarded\": %d, \"capacity\": %d}",
+				        pass.references, pass.discarded, pass.capacity);
+			}
+			fprintf(file, "%s]\n    }", block.passes.empty() ? "" : "\n      ");
+		}
+		fprintf(file, "%s]\n}\n", blocks.empty() ? "" : "\n  ");
+		bool ok = !ferror(file);
+		return fclose(file) == 0 && ok;
+	}
+};
+
+// The report being filled in by the current thread, or NULL for none
+inline RunReport*& report_current() {
+	thread_local RunReport *report = NULL;
+	return report;
+}
+
+// The hunk or block being crunched by the current thread, or NULL for none
+inline BlockReport*& report_block() {
+	thread_local BlockReport *block = NULL;
+	return block;
+}
+
+// Fill in the given report from the current thread while in scope
+class ReportScope {
+	RunReport *previous;
+
+public:
+	ReportScope(RunReport *report) : previous(report_current()) {
+		report_current() = report;
+	}
+
+	~ReportScope() {
+		report_current() = previous;
+	}
+};
+
+// Attribute phase timings of the current thread to a new hunk or block
+// of the current report while in scope
+class ReportBlockScope {
+	BlockReport *previous;
+
+public:
+	ReportBlockScope(const char *kind, int index, int length) : previous(report_block()) {
+		report_block() = report_current() ? report_current()->begin_block(kind, index, length) : NULL;
+	}
+
+	~ReportBlockScope() {
+		report_block() = previous;
+	}
+};
@@ -0,0 +1,176 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+On-disk cache of parse results, for incremental recrunching.
+
+Each entry is stored in a file in the cache directory, named by a hash of
+everything which influences the result: the cache format version, the
+block contents, the pack parameters, the reference buffer size and growth
+limit, and the initial statistics. For hunks, the relocations are included
+as well. An entry contains the edges of the final parse result, along with
+the final symbol statistics and the size the reference buffer grew to, so
+that later blocks see the same buffer as without the cache.
+
+A cached parse can be encoded directly into the range coder, skipping all
+parsing passes. The verifier checks the result as usual, so a corrupt or
+colliding entry will not go unnoticed.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <sys/stat.h>
+
+using std::max;
+using std::string;
+
+#include "Pack.h"
+
+#define RESULT_CACHE_VERSION 2
+
+// 64-bit FNV-1a hash of cache entry contents
+class ResultCacheKey {
+	unsigned long long hash;
+
+public:
+	ResultCacheKey() : hash(0xCBF29CE484222325ULL) {
+		add(RESULT_CACHE_VERSION);
+	}
+
+	void add(const void *bytes, int length) {
+		const unsigned char *p = (const unsigned char *) bytes;
+		for (int i = 0 ; i < length ; i++) {
+			hash = (hash ^ p[i]) * 0x100000001B3ULL;
+		}
+	}
+
+	void add(int value) {
+		add(&value, sizeof(int));
+	}
+
+	void add(const CountingCoder& counts) {
+		for (int i = 0 ; i < counts.context_counts.size() ; i++) {
+			add(counts.context_counts[i].counts[0]);
+			add(counts.context_counts[i].counts[1]);
+		}
+	}
+
+	void add(const PackParams& params) {
+		add(params.parity_context);
+		add(params.greedy_first_pass);
+		add(params.beam_width);
+		add(params.iterations);
+		add(params.length_margin);
+		add(params.skip_length);
+		add(params.match_patience);
+		add(params.max_same_length);
+		add(params.max_offset);
+	}
+
+	void add(RefEdgeFactory& edge_factory) {
+		add(edge_factory.capacity());
+		add(edge_factory.get_growth_limit());
+	}
+
+	string name() const {
+		char buffer[17];
+		sprintf(buffer, "%016llx", hash);
+		return string(buffer);
+	}
+};
+
+class ResultCache {
+	static const int MAGIC = 0x53684C5A; // "ShLZ"
+
+	string directory;
+
+	string path(const ResultCacheKey& key) {
+		return directory + "/" + key.name() + ".lzp";
+	}
+
+	static bool read(FILE *file, void *buffer, int size) {
+		return fread(buffer, 1, size, file) == size;
+	}
+
+	static bool write(FILE *file, const void *buffer, int size) {
+		return fwrite(buffer, 1, size, file) == size;
+	}
+
+public:
+	int hits;
+	int misses;
+
+	ResultCache(const char *directory) : directory(directory), hits(0), misses(0) {
+#ifdef _WIN32
+		mkdir(directory);
+#else
+		mkdir(directory, 0777);
+#endif
+	}
+
+	// Look up a result for the given data. Returns whether it was found.
+	// On a hit, the reference buffer takes over the size it grew to.
+	bool lookup(const ResultCacheKey& key, const unsigned char *data, int data_length, int zero_padding, RefEdgeFactory *edge_factory, LZParseResult *result, CountingCoder *final_counts) {
+		FILE *file = fopen(path(key).c_str(), "rb");
+		bool ok = file != NULL;
+		int header[6];
+		ok = ok && read(file, header, sizeof(header));
+		ok = ok && header[0] == MAGIC && header[1] == data_length && header[2] == zero_padding;
+		ok = ok && header[3] == final_counts->context_counts.size() && header[4] >= 0;
+		ok = ok && header[5] >= edge_factory->capacity() && header[5] <= max(edge_factory->capacity(), edge_factory->get_growth_limit());
+		if (ok) {
+			ok = read(file, &final_counts->context_counts[0], header[3] * sizeof(ContextCounts));
+			result->edges.clear();
+			int end = data_length;
+			for (int i = 0 ; ok && i < header[4] ; i++) {
+				int edge[3];
+				ok = read(file, edge, sizeof(edge));
+				// Edges are stored backwards and must fit within the data
+				ok = ok && edge[0] >= 1 && edge[1] >= 1 && edge[1] <= edge[0] && edge[2] >= 2 && edge[0] + edge[2] <= end;
+				end = edge[0];
+				result->edges.push_back(LZResultEdge(edge[0], edge[1], edge[2]));
+			}
+		}
+		if (file) fclose(file);
+		if (!ok) {
+			misses++;
+			return false;
+		}
+		result->data = data;
+		result->data_length = data_length;
+		result->zero_padding = zero_padding;
+		edge_factory->restore_capacity(header[5]);
+		hits++;
+		return true;
+	}
+
+	// Store a result. Failure to write is not an error.
+	void store(const ResultCacheKey& key, const LZParseResult& result, RefEdgeFactory *edge_factory, CountingCoder *final_counts) {
+		string final_path = path(key);
+		char suffix[32];
+		sprintf(suffix, ".%p.tmp", (void *) &suffix);
+		string temp_path = final_path + suffix;
+		FILE *file = fopen(temp_path.c_str(), "wb");
+		if (!file) return;
+		int header[6] = {
+			MAGIC, result.data_length, result.zero_padding,
+			(int) final_counts->context_counts.size(), (int) result.edges.size(),
+			edge_factory->capacity()
+		};
+		bool ok = write(file, header, sizeof(header));
+		ok = ok && write(file, &final_counts->context_counts[0], header[3] * sizeof(ContextCounts));
+		for (int i = 0 ; ok && i < result.edges.size() ; i++) {
+			const LZResultEdge& e = result.edges[i];
+			int edge[3] = { e.pos, e.offset, e.length };
+			ok = write(file, edge, sizeof(edge));
+		}
+		ok = fclose(file) == 0 && ok;
+		if (!ok || rename(temp_path.c_str(), final_path.c_str()) != 0) {
+			remove(temp_path.c_str());
+		}
+	}
+};
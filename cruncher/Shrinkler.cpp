@@ -14,6 +14,7 @@ Main file for the cruncher.
 
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <string>
 #include <sys/stat.h>
 
@@ -21,32 +22,63 @@ using std::string;
 
 #include "HunkFile.h"
 #include "DataFile.h"
+#include "ThreadPool.h"
+#include "Daemon.h"
+
+// Thrown after printing usage information, ending the command
+class UsageExit {};
 
 void usage() {
-	printf("Usage: Shrinkler <options> <input executable> <output executable>\n");
-	printf("\n");
-	printf("Available options are (default values in parentheses):\n");
-	printf(" -d, --data           Treat input as raw data, rather than executable\n");
-	printf(" -b, --bytes          Disable parity context - better on byte-oriented data\n");
-	printf(" -w, --header         Write data file header for easier loading\n");
-	printf(" -h, --hunkmerge      Merge hunks of the same memory type\n");
-	printf(" -u, --no-crunch      Process hunks without crunching\n");
-	printf(" -o, --overlap        Overlap compressed and decompressed data to save memory\n");
-	printf(" -m, --mini           Use a smaller, but more restricted decrunch header\n");
-	printf(" -c, --commandline    Support passing commandline arguments to the program\n");
-	printf(" -1, ..., -9          Presets for all compression options (-3)\n");
-	printf(" -i, --iterations     Number of iterations for the compression (3)\n");
-	printf(" -l, --length-margin  Number of shorter matches considered for each match (3)\n");
-	printf(" -a, --same-length    Number of matches of the same length to consider (30)\n");
-	printf(" -e, --effort         Perseverance in finding multiple matches (300)\n");
-	printf(" -s, --skip-length    Minimum match length to accept greedily (3000)\n");
-	printf(" -r, --references     Number of reference edges to keep in memory (100000)\n");
-	printf(" -t, --text           Print a text, followed by a newline, before decrunching\n");
-	printf(" -T, --textfile       Print the contents of the given file before decrunching\n");
-	printf(" -f, --flash          Poke into a register (e.g. DFF180) during decrunching\n");
-	printf(" -p, --no-progress    Do not print progress info: no ANSI codes in output\n");
-	printf("\n");
-	exit(0);
+	status("Usage: Shrinkler <options> <input executable> <output executable>\n");
+	status("\n");
+	status("Available options are (default values in parentheses):\n");
+	status(" -d, --data           Treat input as raw data, rather than executable\n");
+	status("                      A file name of - then means standard input or output\n");
+	status(" -b, --bytes          Disable parity context - better on byte-oriented data\n");
+	status(" -w, --header         Write data file header for easier loading\n");
+	status(" -z, --decompress     Decompress instead of crunching\n");
+	status(" -h, --hunkmerge      Merge hunks of the same memory type\n");
+	status(" -u, --no-crunch      Process hunks without crunching\n");
+	status(" -o, --overlap        Overlap compressed and decompressed data to save memory\n");
+	status(" -m, --mini           Use a smaller, but more restricted decrunch header\n");
+	status(" -c, --commandline    Support passing commandline arguments to the program\n");
+	status(" -1, ..., -9          Presets for all compression options (-3)\n");
+	status(" -i, --iterations     Number of iterations for the compression (3)\n");
+	status(" -l, --length-margin  Number of shorter matches considered for each match (3)\n");
+	status(" -a, --same-length    Number of matches of the same length to consider (30)\n");
+	status(" -e, --effort         Perseverance in finding multiple matches (300)\n");
+	status(" -s, --skip-length    Minimum match length to accept greedily (3000)\n");
+	status(" -g, --greedy-start   Use a fast greedy parse for the first iteration\n");
+	status(" -k, --beam           Beam width for fast parsing, 0 for optimal (0)\n");
+	status(" -r, --references     Number of reference edges to keep in memory (100000)\n");
+	status(" -E, --edge-file      Keep reference edges in a temporary file, for large -r\n");
+	status(" -G, --grow-refs      Grow reference buffer when full, up to this many MB\n");
+	status(" -B, --budget         Distribute crunching time (seconds) across hunks\n");
+	status(" -L, --load-stats     Start from symbol statistics saved by a previous run\n");
+	status(" -S, --save-stats     Save final symbol statistics to the given file\n");
+	status(" -x, --cross-hunk     Start each hunk from statistics of the previous one\n");
+	status(" -C, --cache          Directory for caching hunk parse results\n");
+	status(" -t, --text           Print a text, followed by a newline, before decrunching\n");
+	status(" -T, --textfile       Print the contents of the given file before decrunching\n");
+	status(" -f, --flash          Poke into a register (e.g. DFF180) during decrunching\n");
+	status(" -p, --no-progress    Do not print progress info: no ANSI codes in output\n");
+	status(" -F, --batch          Process the input/output file pairs listed in a file\n");
+	status(" -n, --blocks         Crunch data as independent blocks of the given size\n");
+	status(" -j, --jobs           Number of files or blocks to process in parallel\n");
+	status(" -I, --index          Checkpoint index file, written when crunching data\n");
+	status("                      and used for seeking when decompressing\n");
+	status(" -K, --index-step     Distance in bytes between checkpoints (65536)\n");
+	status(" -O, --seek           Decompress data from this position onwards (0)\n");
+	status(" -N, --seek-length    Number of bytes to decompress when seeking (all)\n");
+	status(" -W, --window         Limit reference offsets for decompressing as a stream\n");
+	status(" -M, --max-memory     Memory budget for crunching, in megabytes (none)\n");
+	status(" -R, --report         Write timings and statistics of the crunching as JSON\n");
+	status(" -P, --trace          Write a timeline of the crunching phases as Chrome\n");
+	status("                      trace events, for viewing in Perfetto\n");
+	status(" -D, --daemon         Serve commands on a Unix socket, keeping buffers warm\n");
+	status("                      Commands are sent there when SHRINKLER_DAEMON is set\n");
+	status("\n");
+	throw UsageExit();
 }
 
 class Parameter {
@@ -60,7 +92,7 @@ protected:
 		for (int i = 1 ; i < argc ; i++) {
 			if (strcmp(argv[i], form1) == 0 || strcmp(argv[i], form2) == 0) {
 				if (seen) {
-					printf("Error: %s specified multiple times.\n\n", argv[i]);
+					status("Error: %s specified multiple times.\n\n", argv[i]);
 					usage();
 				}
 				consumed[i] = true;
@@ -69,7 +101,7 @@ protected:
 						seen = parseArg(argv[i], argv[i+1]);
 					}
 					if (!seen) {
-						printf("Error: %s requires a %s argument.\n\n", argv[i], arg_kind);
+						status("Error: %s requires a %s argument.\n\n", argv[i], arg_kind);
 						usage();
 					}
 					consumed[i+1] = true;
@@ -103,7 +135,7 @@ protected:
 		value = strtol(arg, &endptr, 10);
 		if (endptr == &arg[strlen(arg)]) {
 			if (value < min_value || value > max_value) {
-				printf("Error: Argument of %s must be between %d and %d.\n\n", param, min_value, max_value);
+				status("Error: Argument of %s must be between %d and %d.\n\n", param, min_value, max_value);
 				usage();
 			}
 			return true;
@@ -177,7 +209,7 @@ public:
 			const char *a = argv[i];
 			if (strlen(a) == 2 && a[0] == '-' && a[1] >= '0' && a[1] <= '9') {
 				if (seen) {
-					printf("Error: Numeric parameter specified multiple times.\n\n");
+					status("Error: Numeric parameter specified multiple times.\n\n");
 					usage();
 				}
 				consumed[i] = true;
@@ -194,8 +226,625 @@ protected:
 	}
 };
 
-int main2(int argc, const char *argv[]) {
-	printf(SHRINKLER_TITLE);
+// Settings for processing a file, as given on the command line
+struct FileSettings {
+	PackParams params;
+	bool data;
+	bool header;
+	bool bytes;
+	bool decompress;
+	bool hunkmerge;
+	bool no_crunch;
+	bool overlap;
+	bool mini;
+	bool commandline;
+	string *decrunch_text;
+	unsigned flash_address;
+	int budget; // Seconds, or 0 for no budget
+	int block_size; // Bytes, or 0 for a single stream
+	int jobs; // Threads for crunching or decrunching blocks
+	const char *index_file; // Checkpoint index to write or use, or NULL
+	int index_step; // Bytes between checkpoints
+	bool seek; // Decompress only part of the data
+	int seek_start;
+	int seek_length;
+	int window; // Maximum reference offset, or 0 for unlimited
+	bool references_given; // Keep the reference buffer size under a memory budget
+	int grow_references; // Megabytes to grow the reference buffer to, or 0 for fixed
+	int concurrent_files; // Files crunched at the same time, sharing the memory budget
+	const char *report_file; // Crunching report to write, or NULL
+	ModelStatistics *stats;
+	LZProgress *progress;
+};
+
+// State kept by a worker between files, so that buffers stay warm
+class FileWorker {
+public:
+	int references; // Reference buffer as requested
+	bool edge_file;
+	RefEdgeFactory *edge_factory;
+	ResultCache *cache;
+
+	FileWorker(int references, bool edge_file) : references(references), edge_file(edge_file),
+		edge_factory(NULL), cache(NULL)
+	{
+		fit_edge_factory(references, edge_file);
+	}
+
+	// Use a reference buffer of the given size, keeping the current one if it matches
+	void fit_edge_factory(int capacity, bool file_backed) {
+		if (edge_factory && edge_factory->capacity() == capacity && edge_factory->file_backed() == file_backed) return;
+		delete edge_factory;
+		edge_factory = NULL;
+		edge_factory = new RefEdgeFactory(capacity, file_backed);
+	}
+
+	// The cache directory is relative to the working directory of the
+	// command, so the cache is set up anew for every command.
+	void set_cache(const char *cache_dir) {
+		delete cache;
+		cache = cache_dir ? new ResultCache(cache_dir) : NULL;
+	}
+
+	~FileWorker() {
+		delete edge_factory;
+		delete cache;
+	}
+};
+
+// Workers kept between commands when running as a daemon
+class WorkerPool {
+	vector<FileWorker*> workers;
+	const char *cache_dir;
+
+public:
+	WorkerPool() : cache_dir(NULL) {}
+
+	~WorkerPool() {
+		for (int w = 0 ; w < workers.size() ; w++) {
+			delete workers[w];
+		}
+	}
+
+	// Make n workers available with the given settings, reusing existing
+	// workers where the reference buffer matches.
+	void prepare(int n, int references, bool edge_file, const char *cache_dir) {
+		this->cache_dir = cache_dir;
+		while (workers.size() < n) {
+			workers.push_back(NULL);
+		}
+		for (int w = 0 ; w < n ; w++) {
+			if (workers[w] && (workers[w]->references != references || workers[w]->edge_file != edge_file)) {
+				delete workers[w];
+				workers[w] = NULL;
+			}
+			if (!workers[w]) {
+				workers[w] = new FileWorker(references, edge_file);
+			}
+			workers[w]->set_cache(cache_dir);
+		}
+	}
+
+	FileWorker& worker(int w) {
+		return *workers[w];
+	}
+
+	// Replace a worker which may have been left in an inconsistent state
+	// by an aborted file.
+	void discard(int w) {
+		int references = workers[w]->references;
+		bool edge_file = workers[w]->edge_file;
+		delete workers[w];
+		workers[w] = new FileWorker(references, edge_file);
+		workers[w]->set_cache(cache_dir);
+	}
+};
+
+// Fit the reference buffer of the worker to the memory budget for crunching
+// blocks of at most the given length using the given number of threads,
+// reducing the budget in params to the share of each thread. Without a
+// budget, the buffer is as requested. Returns the predicted peak memory
+// use in bytes, or 0 if there is no budget.
+long long fit_memory(PackParams *params, FileSettings& settings, FileWorker& worker, int length, int n_workers) {
+	if (!params->max_memory) {
+		worker.fit_edge_factory(worker.references, worker.edge_file);
+		return 0;
+	}
+	int total_budget = params->max_memory;
+	params->max_memory = max(total_budget / (n_workers * settings.concurrent_files), 1);
+	bool edge_file = worker.edge_file;
+	int references = MemoryBudget::fit_references(params, length, worker.references, settings.references_given, &edge_file);
+	worker.fit_edge_factory(references, edge_file);
+	long long predicted = MemoryBudget::predicted(params, length, references, edge_file) * n_workers;
+
+	status("Memory budget:%13d MB\n", total_budget);
+	status("Reference buffer:%13d%s\n", references, edge_file ? " edges in temporary file" : " edges");
+	status("Match finder arrays: %s\n", MemoryBudget::file_backed_matcher(params, length, references, edge_file) ? "in temporary files" : "in memory");
+	status("Predicted peak:%12lld MB\n\n", (predicted + (1 << 20) - 1) >> 20);
+	if (predicted > (long long) total_budget << 20) {
+		status("Warning: The input is too large to crunch within the memory budget.\n\n");
+	}
+	return predicted;
+}
+
+// Let the reference buffer grow between passes, if enabled
+void enable_growth(PackParams *params, FileSettings& settings, RefEdgeFactory& edge_factory, int length) {
+	int limit = 0;
+	if (settings.grow_references) {
+		limit = MemoryBudget::growth_limit(params, length, settings.grow_references, edge_factory.file_backed());
+	}
+	edge_factory.set_growth_limit(limit);
+	edge_factory.resizes.clear();
+}
+
+void report_growth(RefEdgeFactory& edge_factory) {
+	for (int i = 0 ; i < edge_factory.resizes.size() ; i++) {
+		status("Reference buffer grown to %d edges\n", edge_factory.resizes[i]);
+	}
+	if (!edge_factory.resizes.empty()) {
+		status("\n");
+	}
+}
+
+void report_memory(long long predicted) {
+	long long peak = MemoryBudget::peak_usage();
+	if (predicted && peak) {
+		status("Peak memory use:%11lld MB (predicted at most %lld MB)\n\n", (peak + (1 << 20) - 1) >> 20, (predicted + (1 << 20) - 1) >> 20);
+	}
+	if (predicted) {
+		MemoryTracker::print(status_stream());
+	}
+}
+
+// Record the parameters used for crunching in the report
+void report_parameters(RunReport& report, PackParams *params, FileSettings& settings, RefEdgeFactory& edge_factory) {
+	report.set_parameter("iterations", params->iterations);
+	report.set_parameter("length_margin", params->length_margin);
+	report.set_parameter("same_length", params->max_same_length);
+	report.set_parameter("effort", params->match_patience);
+	report.set_parameter("skip_length", params->skip_length);
+	report.set_parameter("greedy_start", params->greedy_first_pass);
+	report.set_parameter("beam", params->beam_width);
+	report.set_parameter("parity_context", params->parity_context);
+	report.set_parameter("window", params->max_offset);
+	report.set_parameter("max_memory", params->max_memory);
+	report.set_parameter("references", edge_factory.capacity());
+	report.set_parameter("edge_file", edge_factory.file_backed());
+	report.set_parameter("grow_references", edge_factory.get_growth_limit());
+	report.set_parameter("budget", settings.budget);
+	report.set_parameter("blocks", settings.block_size);
+	report.set_parameter("jobs", settings.block_size ? settings.jobs : 1);
+}
+
+// Write the crunching report, if one was requested
+void save_report(RunReport& report, FileSettings& settings, const char *infile, const char *outfile,
+                 int input_size, int output_size, RefEdgeFactory& edge_factory, Stopwatch& stopwatch) {
+	if (!settings.report_file) return;
+	report.set("input", infile);
+	report.set("output", outfile);
+	report.set("mode", settings.data ? "data" : "executable");
+	report.set("input_size", input_size);
+	report.set("output_size", output_size);
+	report.set("references_considered", edge_factory.max_edge_count);
+	report.set("references_discarded", edge_factory.max_cleaned_edges);
+	report.set("reference_buffer", edge_factory.capacity());
+	report.set("peak_memory", MemoryBudget::peak_usage());
+	report.set("time", stopwatch.elapsed());
+
+	status("Saving report %s...\n\n", settings.report_file);
+	if (!report.save(settings.report_file)) {
+		status("Error while writing file %s\n\n", settings.report_file);
+		fatal_error();
+	}
+}
+
+// Compress or decompress a file. Status output goes to the status stream.
+void process_file(const char *infile, const char *outfile, FileSettings& settings, FileWorker& worker) {
+	worker.edge_factory->max_edge_count = 0;
+	worker.edge_factory->max_cleaned_edges = 0;
+	MemoryTracker::reset_peaks();
+
+	// Filled in along the way if a report is requested
+	Stopwatch stopwatch(true);
+	RunReport report;
+	ReportScope report_scope(settings.report_file ? &report : NULL);
+
+	if (settings.data && settings.decompress) {
+		// Data file decompression
+		status("Loading file %s...\n\n", infile);
+		DataFile *packed = new DataFile;
+		packed->load(infile);
+		bool parity_context = !settings.bytes;
+		if (settings.header) {
+			if (!packed->read_header()) {
+				status("Error: File %s does not have a valid data file header.\n\n", infile);
+				delete packed;
+				fatal_error();
+			}
+			parity_context = packed->header_parity_context();
+		}
+
+		int window = settings.header ? packed->header_window() : settings.window;
+		if (window && !settings.seek && packed->block_count() == 0) {
+			// Write the output as it is decrunched, keeping only the window in memory
+			int size = packed->decrunch_stream(outfile, parity_context, settings.header, window);
+			delete packed;
+			if (size < 0) {
+				status("Error: Compressed data is corrupt.\n\n");
+				fatal_error();
+			}
+
+			status("Final file size: %d\n\n", size);
+
+			return;
+		}
+
+		DataFile *unpacked;
+		if (settings.seek) {
+			CheckpointIndex *index = NULL;
+			if (settings.index_file) {
+				index = new CheckpointIndex;
+				if (!index->load(settings.index_file)) {
+					status("Error: Could not read checkpoint index %s\n\n", settings.index_file);
+					delete index;
+					delete packed;
+					fatal_error();
+				}
+				if (!packed->index_matches(index, parity_context)) {
+					status("Error: Checkpoint index %s does not belong to file %s.\n\n", settings.index_file, infile);
+					delete index;
+					delete packed;
+					fatal_error();
+				}
+			}
+			unpacked = packed->decrunch_range(parity_context, settings.header, index, settings.seek_start, settings.seek_length);
+			delete index;
+		} else {
+			unpacked = packed->decrunch(parity_context, settings.header, settings.jobs);
+		}
+		delete packed;
+		if (!unpacked) {
+			status("Error: Compressed data is corrupt.\n\n");
+			fatal_error();
+		}
+
+		status("Saving file %s...\n\n", outfile);
+		unpacked->save(outfile, false);
+
+		status("Final file size: %d\n\n", unpacked->size(false));
+		delete unpacked;
+
+		return;
+	}
+
+	if (settings.data) {
+		// Data file compression
+		status("Loading file %s...\n\n", infile);
+		DataFile *orig = new DataFile;
+		orig->load(infile);
+
+		PackParams params = settings.params;
+		int length = orig->size(false);
+		int n_blocks = settings.block_size ? (length + settings.block_size - 1) / settings.block_size : 0;
+		int n_workers = settings.block_size ? min(settings.jobs, max(n_blocks, 1)) : 1;
+		int block_length = settings.block_size ? min(settings.block_size, length) : length;
+		long long predicted = fit_memory(&params, settings, worker, block_length, n_workers);
+		RefEdgeFactory& edge_factory = *worker.edge_factory;
+		enable_growth(&params, settings, edge_factory, block_length);
+		report_parameters(report, &params, settings, edge_factory);
+
+		DataFile *crunched;
+		if (settings.block_size) {
+			crunched = orig->crunch_blocks(&params, settings.block_size, settings.jobs, &edge_factory);
+			if (!crunched) {
+				status("Error: Too many blocks. At most %d blocks are supported.\n\n", DataFile::MAX_BLOCKS);
+				delete orig;
+				fatal_error();
+			}
+		} else {
+			status("Crunching...\n\n");
+			crunched = orig->crunch(&params, settings.stats, &edge_factory, settings.progress);
+		}
+		delete orig;
+
+		if (settings.index_file) {
+			status("Saving checkpoint index %s...\n\n", settings.index_file);
+			int checkpoints = crunched->save_checkpoints(settings.index_file, settings.index_step);
+			status("Checkpoints: %d\n\n", checkpoints);
+		}
+		status("References considered:%8d\n",  edge_factory.max_edge_count);
+		status("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+		report_growth(edge_factory);
+
+		status("Saving file %s...\n\n", outfile);
+		crunched->save(outfile, settings.header);
+
+		int crunched_size = crunched->size(settings.header);
+		status("Final file size: %d\n\n", crunched_size);
+		delete crunched;
+		report_memory(predicted);
+		save_report(report, settings, infile, outfile, length, crunched_size, edge_factory, stopwatch);
+
+		if (edge_factory.max_edge_count > edge_factory.capacity()) {
+			status("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+		}
+
+		return;
+	}
+
+	// Executable file compression
+	status("Loading file %s...\n\n", infile);
+	HunkFile *orig = new HunkFile;
+	orig->load(infile);
+	int orig_size = orig->size();
+	if (!orig->analyze()) {
+		status("\nError while analyzing input file!\n\n");
+		delete orig;
+		fatal_error();
+	}
+
+	if (settings.decompress) {
+		// Executable file decompression
+		HunkFile *unpacked = orig->decrunch();
+		delete orig;
+		if (!unpacked) {
+			status("Error: File %s is not an executable crunched by Shrinkler.\n\n", infile);
+			fatal_error();
+		}
+		if (!unpacked->analyze()) {
+			status("\nError while analyzing decrunched file!\n\n");
+			delete unpacked;
+			fatal_error();
+		}
+
+		status("Saving file %s...\n\n", outfile);
+		unpacked->save(outfile);
+
+		status("Final file size: %d\n\n", unpacked->size());
+		delete unpacked;
+
+		return;
+	}
+
+	if (settings.hunkmerge) {
+		status("Merging hunks...\n\n");
+		HunkFile *merged = orig->merge_hunks(orig->merged_hunklist());
+		delete orig;
+		if (!merged->analyze()) {
+			status("\nError while analyzing merged file!\n\n");
+			delete merged;
+			internal_error();
+		}
+		orig = merged;
+	} else if (settings.no_crunch || orig->requires_hunk_processing()) {
+		status("Processing hunks...\n\n");
+		HunkFile *processed = orig->merge_hunks(orig->identity_hunklist());
+		delete orig;
+		if (!processed->analyze()) {
+			status("\nError while analyzing processed file!\n\n");
+			delete processed;
+			internal_error();
+		}
+		orig = processed;
+	}
+	if (settings.no_crunch) {
+		status("Saving file %s...\n\n", outfile);
+		orig->save(outfile);
+#ifdef S_IRWXU // Is the POSIX file permission API available?
+		chmod(outfile, 0755); // Mark file executable
+#endif
+		status("Final file size: %d\n\n", orig->size());
+		delete orig;
+
+		return;
+	}
+
+	if (settings.mini && !orig->valid_mini()) {
+		status("Input executable not suitable for mini crunching.\n"
+		       "Must contain only one non-empty hunk and no relocations,\n"
+		       "and the final file size must be less than 24k.\n\n");
+		delete orig;
+		fatal_error();
+	}
+	int orig_mem = orig->memory_usage(true);
+	PackParams params = settings.params;
+	long long predicted = fit_memory(&params, settings, worker, orig->size(), 1);
+	RefEdgeFactory& edge_factory = *worker.edge_factory;
+	enable_growth(&params, settings, edge_factory, orig->size());
+	report_parameters(report, &params, settings, edge_factory);
+	status("Crunching...\n\n");
+	EffortScheduler *scheduler = settings.budget ? new EffortScheduler(settings.budget) : NULL;
+	ResultCache *cache = worker.cache;
+	int cache_hits = cache ? cache->hits : 0;
+	int cache_misses = cache ? cache->misses : 0;
+	HunkFile *crunched = orig->crunch(&params, scheduler, settings.stats, cache, settings.overlap, settings.mini, settings.commandline,
+	                                  settings.decrunch_text, settings.flash_address, &edge_factory, settings.progress);
+	delete orig;
+	delete scheduler;
+	if (cache) {
+		status("Cached results used:%10d\n",   cache->hits - cache_hits);
+		status("Results not cached:%11d\n\n", cache->misses - cache_misses);
+	}
+	status("References considered:%8d\n",  edge_factory.max_edge_count);
+	status("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
+	report_growth(edge_factory);
+	if (!crunched->analyze()) {
+		status("\nError while analyzing crunched file!\n\n");
+		delete crunched;
+		internal_error();
+	}
+	int crunched_mem_during = crunched->memory_usage(true);
+	int crunched_mem_after = crunched->memory_usage(settings.mini || settings.overlap);
+
+	status("Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
+	status("Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
+
+	status("Saving file %s...\n\n", outfile);
+	crunched->save(outfile);
+#ifdef S_IRWXU // Is the POSIX file permission API available?
+	chmod(outfile, 0755); // Mark file executable
+#endif
+	int crunched_size = crunched->size();
+	status("Final file size: %d\n\n", crunched_size);
+	delete crunched;
+	report_memory(predicted);
+	save_report(report, settings, infile, outfile, orig_size, crunched_size, edge_factory, stopwatch);
+
+	if (edge_factory.max_edge_count > edge_factory.capacity()) {
+		status("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+	}
+}
+
+void report_internal_error(FILE *out) {
+	fprintf(out,
+		"\n\nShrinkler has encountered an internal error.\n"
+		"Please send a bug report to blueberry@loonies.dk,\n"
+		"providing the file you tried to compress.\n"
+		"\n"
+		"Thanks, and apologies for the inconvenience.\n\n");
+}
+
+void report_out_of_memory(FILE *out) {
+	fprintf(out,
+		"\n\nShrinkler ran out of memory.\n\n"
+		"Some things you can try:\n"
+		" - Free up some memory\n"
+		" - Run it on a machine with more memory\n"
+		" - Reduce the size of the reference buffer (-r option)\n"
+		" - Keep the reference buffer in a temporary file (-E option)\n"
+		" - Split up your biggest hunk into smaller ones\n\n");
+	MemoryTracker::print(out);
+}
+
+// Read the list of input and output files for batch mode.
+// Each line contains an input and an output file name. Empty lines and
+// lines starting with # are ignored.
+vector<pair<string, string> > read_batch_list(const char *filename) {
+	vector<pair<string, string> > batch_files;
+	FILE *file = fopen(filename, "r");
+	if (!file) {
+		status("Error: Could not open batch file %s\n\n", filename);
+		fatal_error();
+	}
+	char line[4096];
+	char infile[4096];
+	char outfile[4096];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), file)) {
+		line_number++;
+		char extra;
+		int n = sscanf(line, "%4095s %4095s %c", infile, outfile, &extra);
+		if (n <= 0 || infile[0] == '#') continue;
+		if (n != 2) {
+			status("Error: Line %d of batch file %s must contain an input and an output file.\n\n", line_number, filename);
+			fclose(file);
+			fatal_error();
+		}
+		batch_files.push_back(make_pair(string(infile), string(outfile)));
+	}
+	fclose(file);
+	return batch_files;
+}
+
+// Runs the files of a batch, capturing the status output for each file
+class BatchRunner : public JobRunner {
+	vector<pair<string, string> >& batch_files;
+	FileSettings& settings;
+	WorkerPool& workers;
+	FILE *out;
+	Trace *trace;
+
+public:
+	vector<FILE*> reports;
+	vector<char> failed;
+
+	BatchRunner(vector<pair<string, string> >& batch_files, FileSettings& settings, WorkerPool& workers, FILE *out)
+		: batch_files(batch_files), settings(settings), workers(workers), out(out), trace(trace_current()),
+		  reports(batch_files.size(), (FILE *) NULL), failed(batch_files.size(), 1) {}
+
+	virtual void run(int worker, int job) {
+		FILE *report = tmpfile();
+		reports[job] = report;
+		StatusRedirect redirect(report ? report : out);
+		TraceScope trace_scope(trace);
+		TraceSpan file_span("file", "file", job);
+		try {
+			process_file(batch_files[job].first.c_str(), batch_files[job].second.c_str(), settings, workers.worker(worker));
+			failed[job] = 0;
+		} catch (FatalError& e) {
+		} catch (std::bad_alloc& e) {
+			report_out_of_memory(status_stream());
+			workers.discard(worker);
+		} catch (std::exception& e) {
+			report_internal_error(status_stream());
+			workers.discard(worker);
+		}
+	}
+};
+
+// Process all files of a batch, printing the report for each file in order
+int process_batch(vector<pair<string, string> >& batch_files, FileSettings& settings, WorkerPool& workers, int references, bool edge_file, const char *cache_dir, int n_workers) {
+	FILE *out = status_stream();
+	ThreadPool pool(n_workers);
+	status("Processing %d files using %d workers...\n\n", (int) batch_files.size(), pool.workers());
+	status_flush();
+
+	workers.prepare(pool.workers(), references, edge_file, cache_dir);
+	BatchRunner runner(batch_files, settings, workers, out);
+	pool.start(&runner, batch_files.size());
+	int n_failed = 0;
+	for (int j = 0 ; j < batch_files.size() ; j++) {
+		pool.wait(j);
+		FILE *report = runner.reports[j];
+		if (report) {
+			rewind(report);
+			char buffer[4096];
+			size_t length;
+			while ((length = fread(buffer, 1, sizeof(buffer), report)) > 0) {
+				if (out) fwrite(buffer, 1, length, out);
+			}
+			fclose(report);
+		}
+		if (runner.failed[j] || pool.failed(j)) {
+			status("Failed: %s\n\n", batch_files[j].first.c_str());
+			n_failed++;
+		}
+		status_flush();
+	}
+	pool.join();
+
+	status("Processed %d files, %d failed.\n\n", (int) batch_files.size(), n_failed);
+	return n_failed > 0 ? 1 : 0;
+}
+
+int run_command(int argc, const char *argv[], FILE *out, FILE *err, WorkerPool& workers, bool daemon_request);
+
+#ifdef DAEMON_SUPPORTED
+// Runs the commands sent to the daemon, keeping workers between commands
+class DaemonRunner : public CommandRunner {
+	WorkerPool workers;
+
+public:
+	virtual int run(int argc, const char *argv[], FILE *out, FILE *err) {
+		return run_command(argc, argv, out, err, workers, true);
+	}
+};
+#endif
+
+// Is the file name - for standard input or output used on the command line?
+bool uses_standard_streams(int argc, const char *argv[]) {
+	for (int i = 1 ; i < argc ; i++) {
+		if (strcmp(argv[i], "-") == 0) return true;
+	}
+	return false;
+}
+
+int main2(int argc, const char *argv[], WorkerPool& workers, bool daemon_request) {
+	// Keep standard output free for data
+	bool streaming = uses_standard_streams(argc, argv);
+	StatusRedirect redirect(streaming && !daemon_request ? stderr : status_stream());
+
+	status(SHRINKLER_TITLE);
 
 	vector<bool> consumed(argc);
 
@@ -205,6 +854,7 @@ int main2(int argc, const char *argv[]) {
 	FlagParameter   data          ("-d", "--data",                                 argc, argv, consumed);
 	FlagParameter   bytes         ("-b", "--bytes",                                argc, argv, consumed);
 	FlagParameter   header        ("-w", "--header",                               argc, argv, consumed);
+	FlagParameter   decompress    ("-z", "--decompress",                           argc, argv, consumed);
 	FlagParameter   hunkmerge     ("-h", "--hunkmerge",                            argc, argv, consumed);
 	FlagParameter   no_crunch     ("-u", "--no-crunch",                            argc, argv, consumed);
 	FlagParameter   overlap       ("-o", "--overlap",                              argc, argv, consumed);
@@ -215,18 +865,39 @@ int main2(int argc, const char *argv[]) {
 	IntParameter    same_length   ("-a", "--same-length",     1,   100000,   10*p, argc, argv, consumed);
 	IntParameter    effort        ("-e", "--effort",          0,   100000,  100*p, argc, argv, consumed);
 	IntParameter    skip_length   ("-s", "--skip-length",     2,   100000, 1000*p, argc, argv, consumed);
+	FlagParameter   greedy_start  ("-g", "--greedy-start",                         argc, argv, consumed);
+	IntParameter    beam          ("-k", "--beam",            0,     1000, p<3?4*p:0, argc, argv, consumed);
 	IntParameter    references    ("-r", "--references",   1000,100000000, 100000, argc, argv, consumed);
+	FlagParameter   edge_file     ("-E", "--edge-file",                            argc, argv, consumed);
+	IntParameter    grow_references("-G", "--grow-refs",       1,  1000000,   1024, argc, argv, consumed);
+	IntParameter    budget        ("-B", "--budget",          1,  1000000,     60, argc, argv, consumed);
+	StringParameter load_stats    ("-L", "--load-stats",                           argc, argv, consumed);
+	StringParameter save_stats    ("-S", "--save-stats",                           argc, argv, consumed);
+	FlagParameter   cross_hunk    ("-x", "--cross-hunk",                           argc, argv, consumed);
+	StringParameter cache_dir     ("-C", "--cache",                                argc, argv, consumed);
 	StringParameter text          ("-t", "--text",                                 argc, argv, consumed);
 	StringParameter textfile      ("-T", "--textfile",                             argc, argv, consumed);
 	HexParameter    flash         ("-f", "--flash",                             0, argc, argv, consumed);
 	FlagParameter   no_progress   ("-p", "--no-progress",                          argc, argv, consumed);
+	StringParameter batch         ("-F", "--batch",                                argc, argv, consumed);
+	IntParameter    blocks        ("-n", "--blocks",        256,1000000000, 1048576, argc, argv, consumed);
+	StringParameter index         ("-I", "--index",                                argc, argv, consumed);
+	IntParameter    index_step    ("-K", "--index-step",   1024,1000000000,  65536, argc, argv, consumed);
+	IntParameter    seek          ("-O", "--seek",            0, INT_MAX,        0, argc, argv, consumed);
+	IntParameter    seek_length   ("-N", "--seek-length",     0, INT_MAX,  INT_MAX, argc, argv, consumed);
+	IntParameter    window        ("-W", "--window",          1, 536870912,  65536, argc, argv, consumed);
+	IntParameter    max_memory    ("-M", "--max-memory",      1,  1000000,   1024, argc, argv, consumed);
+	IntParameter    jobs          ("-j", "--jobs",            1,     1024, ThreadPool::default_workers(), argc, argv, consumed);
+	StringParameter report        ("-R", "--report",                               argc, argv, consumed);
+	StringParameter trace         ("-P", "--trace",                                argc, argv, consumed);
+	StringParameter daemon        ("-D", "--daemon",                               argc, argv, consumed);
 
 	vector<const char*> files;
 
 	for (int i = 1 ; i < argc ; i++) {
 		if (!consumed[i]) {
-			if (argv[i][0] == '-') {
-				printf("Error: Unknown option %s\n\n", argv[i]);
+			if (argv[i][0] == '-' && argv[i][1] != 0) {
+				status("Error: Unknown option %s\n\n", argv[i]);
 				usage();
 			}
 			files.push_back(argv[i]);
@@ -234,208 +905,340 @@ int main2(int argc, const char *argv[]) {
 	}
 
 	if (data.seen && (commandline.seen || hunkmerge.seen || overlap.seen || mini.seen || text.seen || textfile.seen || flash.seen)) {
-		printf("Error: The data option cannot be used together with any of the\n");
-		printf("commandline, hunkmerge, overlap, mini, text, textfile or flash options.\n\n");
+		status("Error: The data option cannot be used together with any of the\n");
+		status("commandline, hunkmerge, overlap, mini, text, textfile or flash options.\n\n");
 		usage();
 	}
 
 	if (bytes.seen && !data.seen) {
-		printf("Error: The bytes option can only be used together with the data option.\n\n");
+		status("Error: The bytes option can only be used together with the data option.\n\n");
 		usage();
 	}
 
 	if (header.seen && !data.seen) {
-		printf("Error: The header option can only be used together with the data option.\n\n");
+		status("Error: The header option can only be used together with the data option.\n\n");
+		usage();
+	}
+
+	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || greedy_start.seen || beam.seen || references.seen || edge_file.seen || grow_references.seen || budget.seen || load_stats.seen || save_stats.seen || cross_hunk.seen || cache_dir.seen || max_memory.seen || report.seen || trace.seen || text.seen || textfile.seen || flash.seen)) {
+		status("Error: The no-crunch option cannot be used together with any of the\n");
+		status("crunching options.\n\n");
+		usage();
+	}
+
+	if (decompress.seen && (hunkmerge.seen || overlap.seen || mini.seen || commandline.seen || text.seen || textfile.seen || flash.seen)) {
+		status("Error: The decompress option cannot be used together with any of the\n");
+		status("hunkmerge, overlap, mini, commandline, text, textfile or flash options.\n\n");
+		usage();
+	}
+
+	if (decompress.seen && (no_crunch.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || greedy_start.seen || beam.seen || references.seen || edge_file.seen || grow_references.seen || budget.seen || load_stats.seen || save_stats.seen || cross_hunk.seen || cache_dir.seen || max_memory.seen || report.seen || trace.seen)) {
+		status("Error: The decompress option cannot be used together with any of the\n");
+		status("crunching options.\n\n");
+		usage();
+	}
+
+	if (decompress.seen && header.seen && bytes.seen) {
+		status("Error: The bytes option cannot be used when decompressing data with\n");
+		status("a header. The parity setting is read from the header.\n\n");
+		usage();
+	}
+
+	if (budget.seen && data.seen) {
+		status("Error: The budget option can only be used for executables.\n\n");
+		usage();
+	}
+
+	if (cross_hunk.seen && data.seen) {
+		status("Error: The cross-hunk option can only be used for executables.\n\n");
 		usage();
 	}
 
-	if (no_crunch.seen && (data.seen || overlap.seen || mini.seen || preset.seen || iterations.seen || length_margin.seen || same_length.seen || effort.seen || skip_length.seen || references.seen || text.seen || textfile.seen || flash.seen)) {
-		printf("Error: The no-crunch option cannot be used together with any of the\n");
-		printf("crunching options.\n\n");
+	if (cache_dir.seen && data.seen) {
+		status("Error: The cache option can only be used for executables.\n\n");
+		usage();
+	}
+
+	if (budget.seen && (preset.seen || iterations.seen || length_margin.seen || effort.seen)) {
+		status("Error: The budget option cannot be used together with a preset or\n");
+		status("the iterations, length-margin or effort options.\n\n");
 		usage();
 	}
 
 	if (overlap.seen && mini.seen) {
-		printf("Error: The overlap and mini options cannot be used together.\n\n");
+		status("Error: The overlap and mini options cannot be used together.\n\n");
 		usage();
 	}
 
 	if (text.seen && textfile.seen) {
-		printf("Error: The text and textfile options cannot both be specified.\n\n");
+		status("Error: The text and textfile options cannot both be specified.\n\n");
 		usage();
 	}
 
 	if (mini.seen && (text.seen || textfile.seen)) {
-		printf("Error: The text and textfile options cannot be used in mini mode.\n\n");
+		status("Error: The text and textfile options cannot be used in mini mode.\n\n");
 		usage();
 	}
 
-	if (files.size() == 0) {
-		printf("Error: No input file specified.\n\n");
+	if (batch.seen && files.size() > 0) {
+		status("Error: Files cannot be given on the command line in batch mode.\n\n");
 		usage();
 	}
-	if (files.size() == 1) {
-		printf("Error: No output file specified.\n\n");
+
+	if (batch.seen && (load_stats.seen || save_stats.seen || cross_hunk.seen)) {
+		status("Error: The batch option cannot be used together with any of the\n");
+		status("load-stats, save-stats or cross-hunk options.\n\n");
 		usage();
 	}
-	if (files.size() > 2) {
-		printf("Error: Too many files specified.\n\n");
+
+	if (batch.seen && report.seen) {
+		status("Error: The report option cannot be used together with the batch option.\n\n");
 		usage();
 	}
 
-	const char *infile = files[0];
-	const char *outfile = files[1];
+	if (blocks.seen && !(data.seen && header.seen)) {
+		status("Error: The blocks option can only be used together with the data and\n");
+		status("header options.\n\n");
+		usage();
+	}
 
-	PackParams params;
+	if (blocks.seen && (decompress.seen || load_stats.seen || save_stats.seen)) {
+		status("Error: The blocks option cannot be used together with any of the\n");
+		status("decompress, load-stats or save-stats options.\n\n");
+		usage();
+	}
+
+	if (index.seen && (!data.seen || batch.seen || blocks.seen)) {
+		status("Error: The index option can only be used together with the data option,\n");
+		status("and not together with the batch or blocks options.\n\n");
+		usage();
+	}
+
+	if (index_step.seen && (!index.seen || decompress.seen)) {
+		status("Error: The index-step option can only be used when writing an index.\n\n");
+		usage();
+	}
+
+	if ((seek.seen || seek_length.seen) && !(data.seen && decompress.seen)) {
+		status("Error: The seek and seek-length options can only be used when\n");
+		status("decompressing data.\n\n");
+		usage();
+	}
+
+	if (window.seen && !data.seen) {
+		status("Error: The window option can only be used together with the data option.\n\n");
+		usage();
+	}
+
+	if (window.seen && decompress.seen && header.seen) {
+		status("Error: The window option cannot be used when decompressing data with\n");
+		status("a header. The window is read from the header.\n\n");
+		usage();
+	}
+
+	if (jobs.seen && !(batch.seen || blocks.seen || (decompress.seen && data.seen))) {
+		status("Error: The jobs option can only be used together with the batch or\n");
+		status("blocks options, or when decompressing data.\n\n");
+		usage();
+	}
+
+	if (daemon.seen && daemon_request) {
+		status("Error: The daemon option cannot be used in a request to a daemon.\n\n");
+		usage();
+	}
+
+	if (daemon.seen && argc != 3) {
+		status("Error: The daemon option cannot be used together with any other\n");
+		status("options or files.\n\n");
+		usage();
+	}
+
+	if (daemon.seen) {
+#ifdef DAEMON_SUPPORTED
+		if (Daemon::running(daemon.value)) {
+			status("Error: Another daemon is already running on socket %s\n\n", daemon.value);
+			fatal_error();
+		}
+		status("Running as daemon on socket %s\n\n", daemon.value);
+		status_flush();
+		DaemonRunner runner;
+		Daemon::run_server(daemon.value, &runner);
+		status("Error: Could not listen on socket %s\n\n", daemon.value);
+		fatal_error();
+#else
+		status("Error: The daemon option is not supported on this platform.\n\n");
+		fatal_error();
+#endif
+	}
+
+	if (streaming && !data.seen) {
+		status("Error: Standard input and output (-) can only be used together with\n");
+		status("the data option.\n\n");
+		usage();
+	}
+
+	if (streaming && daemon_request) {
+		status("Error: Standard input and output (-) cannot be used through a daemon.\n\n");
+		usage();
+	}
+
+	if (!batch.seen) {
+		if (files.size() == 0) {
+			status("Error: No input file specified.\n\n");
+			usage();
+		}
+		if (files.size() == 1) {
+			status("Error: No output file specified.\n\n");
+			usage();
+		}
+		if (files.size() > 2) {
+			status("Error: Too many files specified.\n\n");
+			usage();
+		}
+	}
+
+	FileSettings settings;
+	PackParams& params = settings.params;
 	params.parity_context = !bytes.seen;
+	params.greedy_first_pass = greedy_start.seen;
+	params.beam_width = beam.value;
 	params.iterations = iterations.value;
 	params.length_margin = length_margin.value;
 	params.skip_length = skip_length.value;
 	params.match_patience = effort.value;
 	params.max_same_length = same_length.value;
+	params.max_offset = window.seen ? window.value : 0;
+	params.max_memory = max_memory.seen ? max_memory.value : 0;
+	settings.references_given = references.seen;
+	settings.grow_references = grow_references.seen ? grow_references.value : 0;
+	settings.concurrent_files = batch.seen ? jobs.value : 1;
+
+	PackProgress pack_progress;
+	NoProgress quiet_progress;
+	settings.progress = no_progress.seen || batch.seen ? (LZProgress *) &quiet_progress : &pack_progress;
+
+	settings.data = data.seen;
+	settings.header = header.seen;
+	settings.bytes = bytes.seen;
+	settings.decompress = decompress.seen;
+	settings.hunkmerge = hunkmerge.seen;
+	settings.no_crunch = no_crunch.seen;
+	settings.overlap = overlap.seen;
+	settings.mini = mini.seen;
+	settings.commandline = commandline.seen;
+	settings.flash_address = flash.value;
+	settings.budget = budget.seen ? budget.value : 0;
+	settings.block_size = blocks.seen ? blocks.value : 0;
+	settings.jobs = batch.seen ? 1 : jobs.value;
+	settings.index_file = index.seen ? index.value : NULL;
+	settings.index_step = index_step.value;
+	settings.seek = seek.seen || seek_length.seen || (index.seen && decompress.seen);
+	settings.seek_start = seek.value;
+	settings.seek_length = seek_length.value;
+	settings.window = window.seen ? window.value : 0;
+	settings.report_file = report.seen ? report.value : NULL;
+
+	// Owned here, so they are released however the command ends
+	ModelStatistics stats(cross_hunk.seen);
+	settings.stats = NULL;
+	if (load_stats.seen || save_stats.seen || cross_hunk.seen) {
+		settings.stats = &stats;
+		if (load_stats.seen && !settings.stats->load(load_stats.value)) {
+			status("Statistics file %s not found. Starting without statistics.\n\n", load_stats.value);
+		}
+	}
 
-	string *decrunch_text_ptr = NULL;
+	settings.decrunch_text = NULL;
 	string decrunch_text;
 	if (text.seen) {
 		decrunch_text = text.value;
 		decrunch_text.push_back('\n');
-		decrunch_text_ptr = &decrunch_text;
+		settings.decrunch_text = &decrunch_text;
 	} else if (textfile.seen) {
 		FILE *decrunch_text_file = fopen(textfile.value, "r");
 		if (!decrunch_text_file) {
-			printf("Error: Could not open text file %s\n", textfile.value);
-			exit(1);
+			status("Error: Could not open text file %s\n", textfile.value);
+			fatal_error();
 		}
 		char c;
 		while ((c = fgetc(decrunch_text_file)) != EOF) {
 			decrunch_text.push_back(c);
 		}
 		fclose(decrunch_text_file);
-		decrunch_text_ptr = &decrunch_text;
+		settings.decrunch_text = &decrunch_text;
 	}
 
-	if (data.seen) {
-		// Data file compression
-		printf("Loading file %s...\n\n", infile);
-		DataFile *orig = new DataFile;
-		orig->load(infile);
+	const char *cache_path = cache_dir.seen ? cache_dir.value : NULL;
 
-		printf("Crunching...\n\n");
-		RefEdgeFactory edge_factory(references.value);
-		DataFile *crunched = orig->crunch(&params, &edge_factory, !no_progress.seen);
-		delete orig;
-		printf("References considered:%8d\n",  edge_factory.max_edge_count);
-		printf("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
-
-		printf("Saving file %s...\n\n", outfile);
-		crunched->save(outfile, header.seen);
-
-		printf("Final file size: %d\n\n", crunched->size(header.seen));
-		delete crunched;
-
-		if (edge_factory.max_edge_count > references.value) {
-			printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
-		}
-
-		return 0;
-	}
-
-	// Executable file compression
-	printf("Loading file %s...\n\n", infile);
-	HunkFile *orig = new HunkFile;
-	orig->load(infile);
-	if (!orig->analyze()) {
-		printf("\nError while analyzing input file!\n\n");
-		delete orig;
-		exit(1);
-	}
+	Trace timeline;
+	TraceScope trace_scope(trace.seen ? &timeline : NULL);
 
-	if (hunkmerge.seen) {
-		printf("Merging hunks...\n\n");
-		HunkFile *merged = orig->merge_hunks(orig->merged_hunklist());
-		delete orig;
-		if (!merged->analyze()) {
-			printf("\nError while analyzing merged file!\n\n");
-			delete merged;
-			internal_error();
+	int code = 0;
+	if (batch.seen) {
+		vector<pair<string, string> > batch_files = read_batch_list(batch.value);
+		code = process_batch(batch_files, settings, workers, references.value, edge_file.seen, cache_path, jobs.value);
+	} else {
+		workers.prepare(1, references.value, edge_file.seen, cache_path);
+		try {
+			process_file(files[0], files[1], settings, workers.worker(0));
+		} catch (InternalError& e) {
+			workers.discard(0);
+			throw;
+		} catch (std::bad_alloc& e) {
+			workers.discard(0);
+			throw;
 		}
-		orig = merged;
-	} else if (no_crunch.seen || orig->requires_hunk_processing()) {
-		printf("Processing hunks...\n\n");
-		HunkFile *processed = orig->merge_hunks(orig->identity_hunklist());
-		delete orig;
-		if (!processed->analyze()) {
-			printf("\nError while analyzing processed file!\n\n");
-			delete processed;
-			internal_error();
+		if (save_stats.seen) {
+			settings.stats->save(save_stats.value);
 		}
-		orig = processed;
-	}
-	if (no_crunch.seen) {
-		printf("Saving file %s...\n\n", outfile);
-		orig->save(outfile);
-#ifdef S_IRWXU // Is the POSIX file permission API available?
-		chmod(outfile, 0755); // Mark file executable
-#endif
-		printf("Final file size: %d\n\n", orig->size());
-		delete orig;
-
-		return 0;
 	}
 
-	if (mini.seen && !orig->valid_mini()) {
-		printf("Input executable not suitable for mini crunching.\n"
-		       "Must contain only one non-empty hunk and no relocations,\n"
-		       "and the final file size must be less than 24k.\n\n");
-		delete orig;
-		exit(1);
-	}
-	int orig_mem = orig->memory_usage(true);
-	printf("Crunching...\n\n");
-	RefEdgeFactory edge_factory(references.value);
-	HunkFile *crunched = orig->crunch(&params, overlap.seen, mini.seen, commandline.seen, decrunch_text_ptr, flash.value, &edge_factory, !no_progress.seen);
-	delete orig;
-	printf("References considered:%8d\n",  edge_factory.max_edge_count);
-	printf("References discarded:%9d\n\n", edge_factory.max_cleaned_edges);
-	if (!crunched->analyze()) {
-		printf("\nError while analyzing crunched file!\n\n");
-		delete crunched;
-		internal_error();
+	if (trace.seen) {
+		status("Saving trace %s...\n\n", trace.value);
+		if (!timeline.save(trace.value)) {
+			status("Error while writing file %s\n\n", trace.value);
+			fatal_error();
+		}
 	}
-	int crunched_mem_during = crunched->memory_usage(true);
-	int crunched_mem_after = crunched->memory_usage(mini.seen || overlap.seen);
-
-	printf("Memory overhead during decrunching:  %9d\n",   crunched_mem_during - orig_mem);
-	printf("Memory overhead after decrunching:   %9d\n\n", crunched_mem_after - orig_mem);
 
-	printf("Saving file %s...\n\n", outfile);
-	crunched->save(outfile);
-#ifdef S_IRWXU // Is the POSIX file permission API available?
-	chmod(outfile, 0755); // Mark file executable
-#endif
-	printf("Final file size: %d\n\n", crunched->size());
-	delete crunched;
+	return code;
+}
 
-	if (edge_factory.max_edge_count > references.value) {
-		printf("Note: compression may benefit from a larger reference buffer (-r option).\n\n");
+// Run a command line, with status output to out and error reports to err
+int run_command(int argc, const char *argv[], FILE *out, FILE *err, WorkerPool& workers, bool daemon_request) {
+	StatusRedirect redirect(out);
+	int code = 1;
+	try {
+		code = main2(argc, argv, workers, daemon_request);
+	} catch (UsageExit& e) {
+		code = 0;
+	} catch (FatalError& e) {
+	} catch (InternalError& e) {
+		fflush(out);
+		report_internal_error(err);
+	} catch (std::bad_alloc& e) {
+		fflush(out);
+		report_out_of_memory(err);
+	} catch (std::exception& e) {
+		fflush(out);
+		report_internal_error(err);
 	}
-
-	return 0;
+	fflush(out);
+	fflush(err);
+	return code;
 }
 
+
 int main(int argc, const char *argv[]) {
-	try {
-		return main2(argc, argv);
-	} catch (std::bad_alloc& e) {
-		fflush(stdout);
-		fprintf(stderr,
-			"\n\nShrinkler ran out of memory.\n\n"
-			"Some things you can try:\n"
-			" - Free up some memory\n"
-			" - Run it on a machine with more memory\n"
-			" - Reduce the size of the reference buffer (-r option)\n"
-			" - Split up your biggest hunk into smaller ones\n\n");
-		fflush(stderr);
-		return 1;
+#ifdef DAEMON_SUPPORTED
+	// Hand the command over to a running daemon, if there is one.
+	// Commands using standard input or output are always run locally.
+	const char *daemon_path = getenv("SHRINKLER_DAEMON");
+	int exit_code;
+	if (daemon_path && !uses_standard_streams(argc, argv) && Daemon::run_client(daemon_path, argc, argv, &exit_code)) {
+		return exit_code;
 	}
+#endif
+	WorkerPool workers;
+	return run_command(argc, argv, stdout, stderr, workers, false);
 }
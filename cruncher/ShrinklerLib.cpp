@@ -0,0 +1,154 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Main file for the compression library.
+
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <new>
+#include <exception>
+
+#include "ShrinklerLib.h"
+#include "HunkFile.h"
+#include "DataFile.h"
+
+// Forwards progress to the user callback, in steps of 0.1%
+class CallbackProgress : public LZProgress {
+	ShrinklerProgressCallback callback;
+	void *user_data;
+	int pass;
+	int size;
+	int next_step_threshold;
+	int steps;
+
+public:
+	CallbackProgress(ShrinklerProgressCallback callback, void *user_data)
+		: callback(callback), user_data(user_data), pass(0) {}
+
+	virtual void begin(int size) {
+		this->size = size;
+		steps = 0;
+		next_step_threshold = size / 1000;
+		callback(user_data, pass, 0, size);
+	}
+
+	virtual void update(int pos) {
+		if (pos < next_step_threshold) return;
+		while (pos >= next_step_threshold) {
+			steps += 1;
+			next_step_threshold = (long long) size * (steps + 1) / 1000;
+		}
+		callback(user_data, pass, pos, size);
+	}
+
+	virtual void end() {
+		callback(user_data, pass, size, size);
+		pass++;
+	}
+};
+
+static bool valid_params(const PackParams& params, int references) {
+	return params.iterations >= 1 && params.iterations <= 9 &&
+	       params.length_margin >= 0 && params.length_margin <= 100 &&
+	       params.max_same_length >= 1 && params.max_same_length <= 100000 &&
+	       params.match_patience >= 0 && params.match_patience <= 100000 &&
+	       params.skip_length >= 2 && params.skip_length <= 100000 &&
+	       params.beam_width >= 0 && params.beam_width <= 1000 &&
+	       params.max_offset >= 0 && params.max_memory >= 0 &&
+	       references >= 1000 && references <= 100000000;
+}
+
+PackParams shrinkler_preset(int preset) {
+	int p = preset;
+	PackParams params;
+	params.parity_context = true;
+	params.greedy_first_pass = false;
+	params.beam_width = p < 3 ? 4 * p : 0;
+	params.iterations = p;
+	params.length_margin = p;
+	params.skip_length = 1000 * p;
+	params.match_patience = 100 * p;
+	params.max_same_length = 10 * p;
+	params.max_offset = 0;
+	params.max_memory = 0;
+	return params;
+}
+
+ShrinklerResult shrinkler_compress(const uint8_t *data, size_t length, const PackParams& params,
+                                   ShrinklerProgressCallback progress, void *user_data,
+                                   std::vector<uint8_t> *out, bool header,
+                                   int references, int *safety_margin) {
+	if (!valid_params(params, references) || length == 0 || length > INT_MAX / 2) {
+		return SHRINKLER_INVALID_PARAMS;
+	}
+
+	StatusRedirect quiet(NULL);
+	try {
+		DataFile orig(data, length);
+		PackParams pack_params = params;
+		RefEdgeFactory edge_factory(references);
+		CallbackProgress callback_progress(progress, user_data);
+		NoProgress no_progress;
+		LZProgress *lz_progress = progress ? (LZProgress *) &callback_progress : &no_progress;
+		DataFile *crunched = orig.crunch(&pack_params, NULL, &edge_factory, lz_progress);
+		*out = crunched->contents(header);
+		if (safety_margin) {
+			*safety_margin = crunched->header_safety_margin();
+		}
+		delete crunched;
+	} catch (std::bad_alloc& e) {
+		return SHRINKLER_OUT_OF_MEMORY;
+	} catch (std::exception& e) {
+		return SHRINKLER_INTERNAL_ERROR;
+	}
+	return SHRINKLER_OK;
+}
+
+ShrinklerResult shrinkler_decompress(const uint8_t *data, size_t length, bool header, bool parity_context,
+                                     std::vector<uint8_t> *out) {
+	if (length > INT_MAX) {
+		return SHRINKLER_INVALID_PARAMS;
+	}
+
+	StatusRedirect quiet(NULL);
+	try {
+		DataFile packed(data, length);
+		if (header) {
+			if (!packed.read_header()) {
+				return SHRINKLER_CORRUPT_DATA;
+			}
+			parity_context = packed.header_parity_context();
+		}
+		DataFile *unpacked = packed.decrunch(parity_context, header);
+		if (!unpacked) {
+			return SHRINKLER_CORRUPT_DATA;
+		}
+		*out = unpacked->contents(false);
+		delete unpacked;
+	} catch (std::bad_alloc& e) {
+		return SHRINKLER_OUT_OF_MEMORY;
+	} catch (std::exception& e) {
+		return SHRINKLER_INTERNAL_ERROR;
+	}
+	return SHRINKLER_OK;
+}
+
+const char* shrinkler_result_string(ShrinklerResult result) {
+	switch (result) {
+	case SHRINKLER_OK:
+		return "OK";
+	case SHRINKLER_INVALID_PARAMS:
+		return "Invalid parameters";
+	case SHRINKLER_CORRUPT_DATA:
+		return "Compressed data is corrupt";
+	case SHRINKLER_OUT_OF_MEMORY:
+		return "Out of memory";
+	case SHRINKLER_INTERNAL_ERROR:
+		return "Internal error";
+	}
+	return "Unknown error";
+}
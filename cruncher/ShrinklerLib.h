@@ -0,0 +1,55 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Library interface for compressing and decompressing data in memory.
+
+The compressed format is the same as for data files produced with the
+--data option, optionally including the data file header (--header).
+
+The functions never print anything or terminate the process. Errors are
+reported through the return value. Any number of calls can run at the
+same time in different threads.
+
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "PackParams.h"
+
+enum ShrinklerResult {
+	SHRINKLER_OK = 0,
+	SHRINKLER_INVALID_PARAMS,
+	SHRINKLER_CORRUPT_DATA,
+	SHRINKLER_OUT_OF_MEMORY,
+	SHRINKLER_INTERNAL_ERROR
+};
+
+// Called when a compression pass begins (pos = 0), at every 0.1% of
+// progress and when the pass ends (pos = size). Passes count from 0.
+typedef void (*ShrinklerProgressCallback)(void *user_data, int pass, int pos, int size);
+
+// Compression parameters for a preset (1 to 9), as selected by -1 to -9
+PackParams shrinkler_preset(int preset);
+
+// Compress a block of data, replacing the contents of out.
+// The progress callback can be NULL. references is the size of the
+// reference buffer (as for the -r option). If safety_margin is given, it
+// receives the minimum safety margin for overlapped decrunching.
+ShrinklerResult shrinkler_compress(const uint8_t *data, size_t length, const PackParams& params,
+                                   ShrinklerProgressCallback progress, void *user_data,
+                                   std::vector<uint8_t> *out, bool header = false,
+                                   int references = 100000, int *safety_margin = NULL);
+
+// Decompress a block of data, replacing the contents of out. With a
+// header, the parity setting is read from the header, and parity_context
+// is ignored.
+ShrinklerResult shrinkler_decompress(const uint8_t *data, size_t length, bool header, bool parity_context,
+                                     std::vector<uint8_t> *out);
+
+// Human-readable description of a result code
+const char* shrinkler_result_string(ShrinklerResult result);
@@ -0,0 +1,51 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Status output for the compression routines.
+
+Progress, statistics and verification errors are printed through these
+functions rather than directly to stdout. Each thread has its own status
+stream, which can be redirected to a different file, or set to NULL to
+silence the output entirely.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <cstdarg>
+
+inline FILE*& status_stream() {
+	thread_local FILE *stream = stdout;
+	return stream;
+}
+
+inline int status(const char *format, ...) {
+	FILE *stream = status_stream();
+	if (!stream) return 0;
+	va_list args;
+	va_start(args, format);
+	int length = vfprintf(stream, format, args);
+	va_end(args);
+	return length;
+}
+
+inline void status_flush() {
+	FILE *stream = status_stream();
+	if (stream) fflush(stream);
+}
+
+// Redirect the status output of the current thread while in scope
+class StatusRedirect {
+	FILE *previous;
+
+public:
+	StatusRedirect(FILE *stream) : previous(status_stream()) {
+		status_stream() = stream;
+	}
+
+	~StatusRedirect() {
+		status_stream() = previous;
+	}
+};
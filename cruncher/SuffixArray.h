@@ -4,6 +4,12 @@
 
 Suffix array construction based on the SA-IS algorithm.
 
+The symbol buckets are kept in scratch space provided by the caller and
+reused by each recursion level. A recursion level has fewer symbols than
+half the length of its parent, so max(length, 2 * alphabet_size + 1)
+elements suffice for the top-level length and alphabet size. Apart from
+that, only the suffix type bits are allocated.
+
 */
 
 #pragma once
@@ -41,6 +47,21 @@ void induce(const int *data, int *suffix_array, int length, int alphabet_size, c
 	}
 }
 
+// Compute the start of each symbol bucket, along with the end of the last one.
+void bucket_starts(const int *data, int length, int alphabet_size, int *buckets) {
+	fill(&buckets[0], &buckets[alphabet_size + 1], 0);
+	for (int i = 0 ; i < length ; i++) {
+		buckets[data[i]]++;
+	}
+	int l = 0;
+	for (int b = 0; b <= alphabet_size; b++) {
+		int l_next = l + buckets[b];
+		buckets[b] = l;
+		l = l_next;
+	}
+	assert(l == length);
+}
+
 bool substrings_equal(const int *data, int i1, int i2, const vector<bool>& stype) {
 	while (data[i1++] == data[i2++]) {
 		if (IS_LMS(i1) && IS_LMS(i2)) return true;
@@ -50,7 +71,8 @@ bool substrings_equal(const int *data, int i1, int i2, const vector<bool>& stype
 
 // Compute the suffix array of a string over an integer alphabet.
 // The last character in the string (the sentinel) must be uniquely smallest in the string.
-void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size) {
+// The scratch space must hold max(length, 2 * alphabet_size + 1) elements.
+void computeSuffixArray(const int *data, int *suffix_array, int length, int alphabet_size, int *scratch) {
 	// Handle empty string
 	assert(length >= 1);
 	if (length == 1) {
@@ -59,16 +81,14 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	vector<bool> stype(length);
-	vector<int> buckets(alphabet_size + 1, 0);
-	vector<int> bucket_index(alphabet_size);
+	int *buckets = &scratch[0];
+	int *bucket_index = &scratch[alphabet_size + 1];
 
-	// Compute suffix types and count symbols
+	// Compute suffix types
 	stype[length - 1] = true;
-	buckets[data[length - 1]] = 1;
 	bool is_s = true;
 	int lms_count = 0;
 	for (int i = length - 2; i >= 0; i--) {
-		buckets[data[i]]++;
 		if (data[i] > data[i + 1]) {
 			if (is_s) lms_count++;
 			is_s = false;
@@ -78,14 +98,7 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 		stype[i] = is_s;
 	}
 
-	// Accumulate bucket sizes
-	int l = 0;
-	for (int b = 0; b <= alphabet_size; b++) {
-		int l_next = l + buckets[b];
-		buckets[b] = l;
-		l = l_next;
-	}
-	assert(l == length);
+	bucket_starts(data, length, alphabet_size, buckets);
 
 	// Put LMS suffixes at the ends of buckets
 	fill(&suffix_array[0], &suffix_array[length], UNINITIALIZED);
@@ -99,7 +112,7 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce to sort LMS strings
-	induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
 
 	// Compact LMS indices at the beginning of the suffix array
 	int j = 0;
@@ -142,8 +155,8 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 		}
 		assert(j == lms_count);
 
-		// Sort named LMS symbols recursively
-		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size);
+		// Sort named LMS symbols recursively, reusing the scratch space
+		computeSuffixArray(sub_data, suffix_array, lms_count, new_alphabet_size, scratch);
 
 		// Map named LMS symbol indices to LMS string indices in input string
 		j = 0;
@@ -157,6 +170,9 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 			assert(suffix_array[s] < lms_count);
 			suffix_array[s] = sub_data[suffix_array[s]];
 		}
+
+		// The recursion overwrote the buckets
+		bucket_starts(data, length, alphabet_size, buckets);
 	}
 
 	// Put LMS suffixes in sorted order at the ends of buckets
@@ -173,5 +189,5 @@ void computeSuffixArray(const int *data, int *suffix_array, int length, int alph
 	}
 
 	// Induce from sorted LMS strings to sort all suffixes
-	induce(data, suffix_array, length, alphabet_size, stype, &buckets[0], &bucket_index[0]);
+	induce(data, suffix_array, length, alphabet_size, stype, buckets, bucket_index);
 }
@@ -0,0 +1,177 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+A pool of worker threads with work stealing.
+
+Jobs are identified by their index. They are initially distributed
+round-robin over one queue per worker. A worker takes jobs from the front
+of its own queue, and when that is empty, steals jobs from the back of the
+queues of the other workers.
+
+A job which throws an exception is marked as failed, leaving it to the
+caller to report the failure.
+
+On platforms without thread support, all jobs are run by the calling
+thread when the pool is started.
+
+*/
+
+#pragma once
+
+#include <deque>
+#include <exception>
+#include <vector>
+
+#ifndef AMIGA
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+using std::deque;
+using std::vector;
+
+class JobRunner {
+public:
+	// Run a job. Worker indices run from 0 to the number of workers - 1.
+	virtual void run(int worker, int job) = 0;
+
+	virtual ~JobRunner() {}
+};
+
+class ThreadPool {
+	struct JobQueue {
+#ifndef AMIGA
+		std::mutex lock;
+#endif
+		deque<int> jobs;
+	};
+
+	JobRunner *runner;
+	vector<JobQueue*> queues;
+	vector<bool> finished;
+	vector<bool> failed_jobs;
+#ifndef AMIGA
+	vector<std::thread> threads;
+	std::mutex finished_lock;
+	std::condition_variable finished_signal;
+#endif
+
+	bool take(int worker, int *job) {
+		int n_workers = queues.size();
+		for (int i = 0 ; i < n_workers ; i++) {
+			JobQueue *queue = queues[(worker + i) % n_workers];
+#ifndef AMIGA
+			std::lock_guard<std::mutex> guard(queue->lock);
+#endif
+			if (!queue->jobs.empty()) {
+				if (i == 0) {
+					*job = queue->jobs.front();
+					queue->jobs.pop_front();
+				} else {
+					*job = queue->jobs.back();
+					queue->jobs.pop_back();
+				}
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void work(int worker) {
+		int job;
+		while (take(worker, &job)) {
+			bool failed = false;
+			try {
+				runner->run(worker, job);
+			} catch (std::exception& e) {
+				failed = true;
+			}
+#ifndef AMIGA
+			std::lock_guard<std::mutex> guard(finished_lock);
+#endif
+			finished[job] = true;
+			failed_jobs[job] = failed;
+#ifndef AMIGA
+			finished_signal.notify_all();
+#endif
+		}
+	}
+
+public:
+	// Number of workers to use by default
+	static int default_workers() {
+#ifndef AMIGA
+		int n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+#else
+		return 1;
+#endif
+	}
+
+	ThreadPool(int n_workers) : runner(NULL) {
+#ifdef AMIGA
+		n_workers = 1;
+#endif
+		for (int w = 0 ; w < n_workers ; w++) {
+			queues.push_back(new JobQueue);
+		}
+	}
+
+	~ThreadPool() {
+		join();
+		for (int w = 0 ; w < queues.size() ; w++) {
+			delete queues[w];
+		}
+	}
+
+	int workers() {
+		return queues.size();
+	}
+
+	// Start running jobs 0 to n_jobs - 1
+	void start(JobRunner *runner, int n_jobs) {
+		this->runner = runner;
+		finished.assign(n_jobs, false);
+		failed_jobs.assign(n_jobs, false);
+		for (int j = 0 ; j < n_jobs ; j++) {
+			queues[j % queues.size()]->jobs.push_back(j);
+		}
+#ifndef AMIGA
+		for (int w = 0 ; w < queues.size() ; w++) {
+			threads.push_back(std::thread(&ThreadPool::work, this, w));
+		}
+#else
+		work(0);
+#endif
+	}
+
+	// Wait for a single job to finish
+	void wait(int job) {
+#ifndef AMIGA
+		std::unique_lock<std::mutex> guard(finished_lock);
+		while (!finished[job]) {
+			finished_signal.wait(guard);
+		}
+#endif
+	}
+
+	// Whether a finished job was ended by an exception
+	bool failed(int job) {
+#ifndef AMIGA
+		std::lock_guard<std::mutex> guard(finished_lock);
+#endif
+		return failed_jobs[job];
+	}
+
+	// Wait for all jobs to finish
+	void join() {
+#ifndef AMIGA
+		for (int w = 0 ; w < threads.size() ; w++) {
+			threads[w].join();
+		}
+		threads.clear();
+#endif
+	}
+};
@@ -0,0 +1,228 @@
+// Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+/*
+
+Timeline of the crunching phases, written in the Chrome trace event
+format, which can be viewed in Perfetto or chrome://tracing.
+
+A span covers a phase from its construction until it ends or goes out of
+scope. Spans can carry an integer tag, such as the hunk number or the
+pass, which is also attached to all spans nested inside it on the same
+thread. Each thread records its spans into its own buffer, using the
+monotonic clock, and the buffers are only combined when the trace is
+saved.
+
+Like the status output, the trace being recorded is kept per thread.
+Spans are only recorded on threads with a current trace.
+
+*/
+
+#pragma once
+
+#include <cstdio>
+#include <ctime>
+#include <vector>
+
+#ifndef AMIGA
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#endif
+
+using std::vector;
+
+struct TraceEvent {
+	static const int MAX_TAGS = 4;
+
+	const char *name;
+	long long start; // Nanoseconds since the start of the trace
+	long long duration;
+	int n_tags;
+	const char *tag_names[MAX_TAGS];
+	int tag_values[MAX_TAGS];
+};
+
+// Tags attached to the spans of the current thread
+struct TraceContext {
+	int n_tags;
+	const char *tag_names[TraceEvent::MAX_TAGS];
+	int tag_values[TraceEvent::MAX_TAGS];
+
+	TraceContext() : n_tags(0) {}
+};
+
+inline TraceContext& trace_context() {
+	thread_local TraceContext context;
+	return context;
+}
+
+class Trace {
+	struct ThreadBuffer {
+		int thread;
+		vector<TraceEvent> events;
+	};
+
+	unsigned id;
+	long long start_time;
+	vector<ThreadBuffer*> buffers;
+#ifndef AMIGA
+	std::mutex lock;
+#endif
+
+	Trace(const Trace&);
+	Trace& operator=(const Trace&);
+
+	static unsigned next_id() {
+#ifndef AMIGA
+		static std::atomic<unsigned> counter(0);
+#else
+		static unsigned counter = 0;
+#endif
+		return ++counter;
+	}
+
+	static long long clock_now() {
+#ifndef AMIGA
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#else
+		return (long long) clock() * (1000000000 / CLOCKS_PER_SEC);
+#endif
+	}
+
+	// The buffer of the calling thread, set up on first use
+	ThreadBuffer* buffer() {
+		thread_local unsigned buffer_trace = 0;
+		thread_local ThreadBuffer *thread_buffer = NULL;
+		if (buffer_trace != id) {
+#ifndef AMIGA
+			std::lock_guard<std::mutex> guard(lock);
+#endif
+			thread_buffer = new ThreadBuffer;
+			thread_buffer->thread = buffers.size();
+			buffers.push_back(thread_buffer);
+			buffer_trace = id;
+		}
+		return thread_buffer;
+	}
+
+	static void write_time(FILE *file, const char *key, long long nanoseconds) {
+		fprintf(file, "\"%s\": %lld.%03lld", key, nanoseconds / 1000, nanoseconds % 1000);
+	}
+
+public:
+	Trace() : id(next_id()), start_time(clock_now()) {}
+
+	~Trace() {
+		for (int i = 0 ; i < buffers.size() ; i++) {
+			delete buffers[i];
+		}
+	}
+
+	// Give the calling thread its buffer, so threads are numbered in the
+	// order they join the trace
+	void attach() {
+		buffer();
+	}
+
+	// Nanoseconds since the start of the trace
+	long long now() {
+		return clock_now() - start_time;
+	}
+
+	void record(const TraceEvent& event) {
+		buffer()->events.push_back(event);
+	}
+
+	bool save(const char *filename) {
+		FILE *file = fopen(filename, "w");
+		if (!file) return false;
+		fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+		bool first = true;
+		for (int b = 0 ; b < buffers.size() ; b++) {
+			const ThreadBuffer& buffer = *buffers[b];
+			fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, ", first ? "" : ",", buffer.thread);
+			if (buffer.thread == 0) {
+				fprintf(file, "\"args\": {\"name\": \"main\"}}");
+			} else {
+				fprintf(file, "\"args\": {\"name\": \"worker %d\"}}", buffer.thread);
+			}
+			first = false;
+			for (int i = 0 ; i < buffer.events.size() ; i++) {
+				const TraceEvent& event = buffer.events[i];
+				fprintf(file, ",\n{\"name\": \"%s\", \"cat\": \"shrinkler\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, ", event.name, buffer.thread);
+				write_time(file, "ts", event.start);
+				fprintf(file, ", ");
+				write_time(file, "dur", event.duration);
+				fprintf(file, ", \"args\": {");
+				for (int t = 0 ; t < event.n_tags ; t++) {
+					fprintf(file, "%s\"%s\": %d", t ? ", " : "", event.tag_names[t], event.tag_values[t]);
+				}
+				fprintf(file, "}}");
+			}
+		}
+		fprintf(file, "\n]}\n");
+		bool ok = !ferror(file);
+		return fclose(file) == 0 && ok;
+	}
+};
+
+// The trace being recorded by the current thread, or NULL for none
+inline Trace*& trace_current() {
+	thread_local Trace *trace = NULL;
+	return trace;
+}
+
+// Record spans of the current thread into the given trace while in scope
+class TraceScope {
+	Trace *previous;
+
+public:
+	TraceScope(Trace *trace) : previous(trace_current()) {
+		trace_current() = trace;
+		if (trace) trace->attach();
+	}
+
+	~TraceScope() {
+		trace_current() = previous;
+	}
+};
+
+// A phase of crunching, recorded from construction until ended
+class TraceSpan {
+	Trace *trace;
+	TraceEvent event;
+	bool tagged;
+
+public:
+	TraceSpan(const char *name, const char *tag_name = NULL, int tag_value = 0) : trace(trace_current()), tagged(false) {
+		if (!trace) return;
+		TraceContext& context = trace_context();
+		if (tag_name && context.n_tags < TraceEvent::MAX_TAGS) {
+			context.tag_names[context.n_tags] = tag_name;
+			context.tag_values[context.n_tags] = tag_value;
+			context.n_tags++;
+			tagged = true;
+		}
+		event.name = name;
+		event.n_tags = context.n_tags;
+		for (int t = 0 ; t < context.n_tags ; t++) {
+			event.tag_names[t] = context.tag_names[t];
+			event.tag_values[t] = context.tag_values[t];
+		}
+		event.start = trace->now();
+	}
+
+	~TraceSpan() {
+		end();
+	}
+
+	void end() {
+		if (!trace) return;
+		event.duration = trace->now() - event.start;
+		trace->record(event);
+		if (tagged) {
+			trace_context().n_tags--;
+		}
+		trace = NULL;
+	}
+};
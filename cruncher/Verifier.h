@@ -8,13 +8,14 @@ Verifying the correctness of crunched data and computing safety margin.
 
 #pragma once
 
+#include "Status.h"
 #include "RangeDecoder.h"
 #include "LZDecoder.h"
 
 
 class LZVerifier : public LZReceiver, public CompressedDataReadListener {
 	int hunk;
-	unsigned char *data;
+	const unsigned char *data;
 	int data_length;
 	int hunk_mem;
 	int read_size;
@@ -28,21 +29,23 @@ class LZVerifier : public LZReceiver, public CompressedDataReadListener {
 public:
 	int compressed_read_count;
 	int front_overlap_margin;
+	int max_offset; // 0 for unlimited
 
-	LZVerifier(int hunk, unsigned char *data, int data_length, int hunk_mem, int read_size)
+	LZVerifier(int hunk, const unsigned char *data, int data_length, int hunk_mem, int read_size)
 		: hunk(hunk), data(data), data_length(data_length), hunk_mem(hunk_mem), read_size(read_size), pos(0) {
 		compressed_read_count = 0;
 		front_overlap_margin = 0;
+		max_offset = 0;
 	}
 
 	bool receiveLiteral(unsigned char lit) {
 		if (pos >= hunk_mem) {
-			printf("Verify error: literal at position %d in hunk %d overflows hunk!\n",
+			status("Verify error: literal at position %d in hunk %d overflows hunk!\n",
 				pos, hunk);
 			return false;
 		}
 		if (lit != getData(pos)) {
-			printf("Verify error: literal at position %d in hunk %d has incorrect value (0x%02X, should be 0x%02X)!\n",
+			status("Verify error: literal at position %d in hunk %d has incorrect value (0x%02X, should be 0x%02X)!\n",
 				pos, hunk, lit, getData(pos));
 			return false;
 		}
@@ -52,18 +55,23 @@ public:
 
 	bool receiveReference(int offset, int length) {
 		if (offset < 1 || offset > pos) {
-			printf("Verify error: reference at position %d in hunk %d has invalid offset (%d)!\n",
+			status("Verify error: reference at position %d in hunk %d has invalid offset (%d)!\n",
 				pos, hunk, offset);
 			return false;
 		}
+		if (max_offset && offset > max_offset) {
+			status("Verify error: reference at position %d in hunk %d has offset (%d) outside window (%d)!\n",
+				pos, hunk, offset, max_offset);
+			return false;
+		}
 		if (length > hunk_mem - pos) {
-			printf("Verify error: reference at position %d in hunk %d overflows hunk (length %d, %d bytes past end)!\n",
+			status("Verify error: reference at position %d in hunk %d overflows hunk (length %d, %d bytes past end)!\n",
 				pos, hunk, length, pos + length - hunk_mem);
 			return false;
 		}
 		for (int i = 0 ; i < length ; i++) {
 			if (getData(pos - offset + i) != getData(pos + i)) {
-				printf("Verify error: reference at position %d in hunk %d has incorrect value for byte %d of %d (0x%02X, should be 0x%02X)!\n",
+				status("Verify error: reference at position %d in hunk %d has incorrect value for byte %d of %d (0x%02X, should be 0x%02X)!\n",
 					pos, hunk, i, length, getData(pos - offset + i), getData(pos + i));
 				return false;
 			}
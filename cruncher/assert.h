@@ -8,16 +8,32 @@ An assert function which contains a breakpoint, for ease of debugging.
 
 #pragma once
 
-void internal_error() {
-	fflush(stdout);
-	fprintf(stderr,
-		"\n\nShrinkler has encountered an internal error.\n"
-		"Please send a bug report to blueberry@loonies.dk,\n"
-		"providing the file you tried to compress.\n"
-		"\n"
-		"Thanks, and apologies for the inconvenience.\n\n");
-	fflush(stderr);
-	exit(1);
+#include <exception>
+
+// Thrown when Shrinkler detects an internal inconsistency. The command line
+// tool reports it and exits, while library users get an error code.
+class InternalError : public std::exception {
+public:
+	virtual const char* what() const throw() {
+		return "Shrinkler has encountered an internal error.";
+	}
+};
+
+inline void internal_error() {
+	throw InternalError();
+}
+
+// Thrown after an error in the input has been reported. The command line
+// tool exits, while batch and library users carry on with the next job.
+class FatalError : public std::exception {
+public:
+	virtual const char* what() const throw() {
+		return "Shrinkler has encountered an error.";
+	}
+};
+
+inline void fatal_error() {
+	throw FatalError();
 }
 
 #ifndef NDEBUG
@@ -0,0 +1,133 @@
+# Copyright 1999-2022 Aske Simon Christensen. See LICENSE.txt for usage terms.
+
+"""
+Round-trip tests on large synthetic data files.
+
+Usage: python3 test/large_inputs.py <path to Shrinkler>
+
+Each input is generated from a fixed seed in a temporary directory (under
+TMPDIR, if set), crunched as a data file with a header, decompressed again
+and compared to the original:
+
+- 8 MB of random bytes. The cost of the parse exceeds the range of an int
+  in 1/64 bits, so this checks the 64-bit cost accounting.
+- 300 MB of mostly zeros, with a random block repeated at an offset above
+  256 MB. After one literal, it is followed by a copy of another block at
+  the same offset modulo 2^28, which must not be taken for a repeated
+  offset. This fails verification if the repeated offset is truncated to
+  28 bits. The output must be smaller than three blocks, showing that both
+  matches were used. A greedy single pass is used to keep the time and
+  memory down, and the match finder arrays are kept in temporary files.
+- A sparse file just over 2 GB, read both as a file and from standard
+  input. Crunching must fail with an error about the size.
+
+The 300 MB case needs about 4 GB of memory and 4 GB of temporary files.
+"""
+
+import os
+import random
+import shutil
+import subprocess
+import sys
+import tempfile
+
+MB = 1024 * 1024
+BLOCK = 32 * 1024
+
+def run(args, stdin=None):
+	result = subprocess.run(args, stdin=stdin, stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+	return result.returncode, result.stdout.decode("latin-1")
+
+def same_contents(path1, path2):
+	with open(path1, "rb") as f1, open(path2, "rb") as f2:
+		while True:
+			chunk1 = f1.read(MB)
+			chunk2 = f2.read(MB)
+			if chunk1 != chunk2:
+				return False
+			if not chunk1:
+				return True
+
+def round_trip(shrinkler, path, options):
+	crunched = path + ".shr"
+	decrunched = path + ".out"
+	code, output = run([shrinkler, "-d", "-w", "-p"] + options + [path, crunched])
+	if code != 0:
+		return "crunching failed:\n" + output
+	code, output = run([shrinkler, "-d", "-w", "-p", "-z", crunched, decrunched])
+	if code != 0:
+		return "decompressing failed:\n" + output
+	if not same_contents(path, decrunched):
+		return "decompressed data differs from the original"
+	return None
+
+def random_data(path, rng):
+	with open(path, "wb") as f:
+		for i in range(8):
+			f.write(rng.randbytes(MB))
+
+def far_match(path, rng):
+	far = 280 * MB
+	first = rng.randbytes(BLOCK)
+	second = rng.randbytes(BLOCK)
+	near = far + BLOCK + 1
+	with open(path, "wb") as f:
+		f.write(first)
+		f.seek(near - (far - (1 << 28)))
+		f.write(second)
+		f.seek(far)
+		f.write(first)
+		f.write(b"\x55")
+		f.write(second)
+		f.truncate(300 * MB)
+
+def too_large(path):
+	with open(path, "wb") as f:
+		f.truncate(2048 * MB + MB)
+
+def main():
+	if len(sys.argv) != 2:
+		sys.stderr.write("Usage: %s <path to Shrinkler>\n" % sys.argv[0])
+		return 2
+	shrinkler = os.path.abspath(sys.argv[1])
+	workdir = tempfile.mkdtemp(prefix="shrinkler-test-")
+	failures = 0
+	try:
+		rng = random.Random(4711)
+
+		def report(name, error):
+			nonlocal failures
+			if error:
+				failures += 1
+				print("FAIL  %s: %s" % (name, error))
+			else:
+				print("OK    %s" % name)
+			sys.stdout.flush()
+
+		path = os.path.join(workdir, "random8m")
+		random_data(path, rng)
+		report("8 MB random data", round_trip(shrinkler, path, ["-1"]))
+		os.remove(path)
+
+		path = os.path.join(workdir, "far300m")
+		far_match(path, rng)
+		error = round_trip(shrinkler, path, ["-g", "-i", "1", "-k", "1", "-M", "1024"])
+		if not error and os.path.getsize(path + ".shr") >= 3 * BLOCK:
+			error = "matches at offsets above 256 MB were not used"
+		report("300 MB data with far matches", error)
+
+		path = os.path.join(workdir, "sparse2g")
+		too_large(path)
+		code, output = run([shrinkler, "-d", "-p", path, path + ".shr"])
+		error = None if code != 0 and "too large" in output else "not rejected:\n" + output
+		report("Over 2 GB data file", error)
+		with open(path, "rb") as f:
+			code, output = run([shrinkler, "-d", "-p", "-", path + ".shr"], stdin=f)
+		error = None if code != 0 and "too large" in output else "not rejected:\n" + output
+		report("Over 2 GB data on standard input", error)
+	finally:
+		shutil.rmtree(workdir)
+	return 1 if failures else 0
+
+if __name__ == "__main__":
+	sys.exit(main())